@@ -44,6 +44,48 @@ uint8_t* Ser25LCxxx::read( uint32_t startAdr,  uint32_t len) {
     if (startAdr+len>_size)
         return NULL;
     uint8_t* ret=(uint8_t*)malloc(len);
+    read(startAdr,len,ret);
+    return ret;
+}
+
+bool Ser25LCxxx::read( uint32_t startAdr,  uint32_t len, uint8_t* buf) {
+    // assertion
+    if (startAdr+len>_size)
+        return false;
+    startRead(startAdr);
+    // read data into buffer
+    for (uint32_t i=0;i<len;i++) {
+        buf[i]=_spi->write(0);
+    }
+    wait_us(1);
+    _enable->write(1);
+    return true;
+}
+
+bool Ser25LCxxx::readStream( uint32_t startAdr,  uint32_t len, uint8_t* buf, uint32_t chunkLen,
+        ChunkCallback chunk, void* context) {
+    // assertion
+    if (startAdr+len>_size || 0==chunkLen)
+        return false;
+    startRead(startAdr);
+    bool b=true;
+    uint32_t ofs=0;
+    while (b && ofs<len) {
+        uint32_t n=len-ofs;
+        if (n>chunkLen)
+            n=chunkLen;
+        for (uint32_t i=0;i<n;i++) {
+            buf[i]=_spi->write(0);
+        }
+        ofs+=n;
+        b=chunk(context,buf,n);
+    }
+    wait_us(1);
+    _enable->write(1);
+    return b;
+}
+
+void Ser25LCxxx::startRead( uint32_t startAdr) {
     _enable->write(0);
     wait_us(1);
     // send address
@@ -63,23 +105,16 @@ uint8_t* Ser25LCxxx::read( uint32_t startAdr,  uint32_t len) {
         _spi->write(HIGH(startAdr));
         _spi->write(LOW(startAdr));
     }
-    // read data into buffer
-    for (uint8_t i=0;i<len;i++) {
-        ret[i]=_spi->write(0);
-    }
-    wait_us(1);
-    _enable->write(1);
-    return ret;
 }
 
 bool Ser25LCxxx::write( uint32_t startAdr,  uint32_t len, const uint8_t* data) {
     if (startAdr+len>_size)
-        return -1;
+        return false;
 
-    uint8_t ofs=0;
+    uint32_t ofs=0;
     while (ofs<len) {
         // calculate amount of data to write into current page
-        uint8_t pageLen=_pageSize-((startAdr+ofs)%_pageSize);
+        uint32_t pageLen=_pageSize-((startAdr+ofs)%_pageSize);
         if (ofs+pageLen>len)
             pageLen=len-ofs;
         // write single page
@@ -93,6 +128,19 @@ bool Ser25LCxxx::write( uint32_t startAdr,  uint32_t len, const uint8_t* data) {
 }
 
 bool Ser25LCxxx::writePage( uint32_t startAdr,  uint32_t len, const uint8_t* data) {
+    if (!startWrite(startAdr,len,data))
+        return false;
+
+    waitForWrite();
+
+    return true;
+}
+
+bool Ser25LCxxx::startWrite( uint32_t startAdr,  uint32_t len, const uint8_t* data) {
+    // assertion
+    if (startAdr+len>_size || (startAdr%_pageSize)+len>_pageSize)
+        return false;
+
     enableWrite();
 
     _enable->write(0);
@@ -116,28 +164,24 @@ bool Ser25LCxxx::writePage( uint32_t startAdr,  uint32_t len, const uint8_t* dat
     }
 
     // do real write
-    for (uint8_t i=0;i<len;i++) {
-        _spi->write(data[i]);
+    for (uint32_t i=0;i<len;i++) {
+        _spi->write(data ? data[i] : 0xff);
     }
     wait_us(1);
     // disable to start physical write
     _enable->write(1);
-    
-    waitForWrite();
 
     return true;
 }
 
+bool Ser25LCxxx::writing() {
+    return readStatus()&1;
+}
+
 bool Ser25LCxxx::clearPage( uint32_t pageNum) {
     enableWrite();
     if (_size<65535) {
-        uint8_t* s=(uint8_t*)malloc(_pageSize);
-        for (uint8_t i=0;i<_pageSize;i++) {
-            s[i]=0xff;
-        }
-        bool b=writePage(_pageSize*pageNum,_pageSize,s);
-        delete s;
-        return b;
+        return writePage(_pageSize*pageNum,_pageSize,NULL);
     } else {
         _enable->write(0);
         wait_us(1);
@@ -155,7 +199,7 @@ bool Ser25LCxxx::clearPage( uint32_t pageNum) {
 void Ser25LCxxx::clearMem() {
     enableWrite();
     if (_size<65535) {
-        for (uint8_t i=0;i<_size/_pageSize;i++) {
+        for (uint32_t i=0;i<_size/_pageSize;i++) {
             if (!clearPage(i))
                 break;
         }
@@ -184,7 +228,7 @@ uint8_t Ser25LCxxx::readStatus() {
 
 void Ser25LCxxx::waitForWrite() {
     while (true) {
-        if (0==readStatus()&1)
+        if (0==(readStatus()&1))
             break;
         wait_us(10);
     }
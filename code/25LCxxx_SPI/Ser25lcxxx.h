@@ -35,6 +35,15 @@ and the page size differs even by constant size (look up the data sheet for your
 class Ser25LCxxx
 {
     public:
+        /**
+            called by readStream() for every chunk read, while /CS is still low
+            @param context the pointer given to readStream()
+            @param data the chunk
+            @param len the number of bytes in the chunk
+            @return false to end the read early
+        */
+        typedef bool (*ChunkCallback)(void* context, const uint8_t* data, uint32_t len);
+
         /**
             create the handler class
             @param spi the SPI port where the eeprom is connected. Must be set to format(8,3), and with a speed matching the one of your device (up to 5MHz should work)
@@ -50,13 +59,49 @@ class Ser25LCxxx
         ~Ser25LCxxx();
         
         /**
-            read a part of the eeproms memory. The buffer will be allocated here, and must be freed by the user
+            read a part of the eeproms memory. The buffer will be allocated here, and must be freed by the user.
+            Prefer the overloads taking a buffer, they don't touch the heap
             @param startAdr the adress where to start reading. Doesn't need to match a page boundary
             @param len the number of bytes to read (must not exceed the end of memory)
             @return NULL if the adresses are out of range, the pointer to the data otherwise
         */
         uint8_t* read( uint32_t startAdr,  uint32_t len);
+
+        /**
+            read a part of the eeproms memory into a buffer provided by the caller. Nothing is allocated.
+            @param startAdr the adress where to start reading. Doesn't need to match a page boundary
+            @param len the number of bytes to read (must not exceed the end of memory)
+            @param buf where the data is stored, must hold at least len bytes
+            @return false if the adresses are out of range
+        */
+        bool read( uint32_t startAdr,  uint32_t len, uint8_t* buf);
+
+        /**
+            read exactly the size of a fixed buffer, known at compile time. Nothing is allocated.
+            @param startAdr the adress where to start reading. Doesn't need to match a page boundary
+            @param buf the array to fill
+            @return false if the adresses are out of range
+        */
+        template<uint32_t N>
+        bool readInto( uint32_t startAdr, uint8_t (&buf)[N]) {
+            return read(startAdr, N, buf);
+        }
         
+        /**
+            read any length with a single READ command, a chunk at a time. /CS stays low from the
+            first to the last byte, so the address is only sent once. The callback must not use
+            the eeprom or anything else on its SPI port. Nothing is allocated.
+            @param startAdr the adress where to start reading. Doesn't need to match a page boundary
+            @param len the number of bytes to read (must not exceed the end of memory)
+            @param buf the chunk buffer, reused for every chunk
+            @param chunkLen the size of buf, the last chunk can be shorter
+            @param chunk called with each chunk
+            @param context passed on to the callback
+            @return false if the adresses are out of range or the callback ended the read
+        */
+        bool readStream( uint32_t startAdr,  uint32_t len, uint8_t* buf, uint32_t chunkLen,
+            ChunkCallback chunk, void* context);
+
         /**
             writes the give buffer into the memory. This function handles dividing the write into 
             pages, and waites until the phyiscal write has finished
@@ -66,6 +111,21 @@ class Ser25LCxxx
         */
         bool write( uint32_t startAdr,  uint32_t len, const uint8_t* data);
         
+        /**
+            starts writing data within a single page and returns without waiting for the
+            physical write. The previous write must have finished, see writing()
+            @param startAdr the adress where to start writing. Doesn't need to match a page boundary
+            @param len the number of bytes to write, must not cross into the next page
+            @param data the data to write, NULL writes 0xFF
+            @return false if the adresses are out of range or cross a page
+        */
+        bool startWrite( uint32_t startAdr,  uint32_t len, const uint8_t* data);
+
+        /**
+            @return true while the eeprom is busy with a physical write (the WIP bit)
+        */
+        bool writing();
+
         /**
             fills the given page with 0xFF
             @param pageNum the page number to clear
@@ -78,6 +138,7 @@ class Ser25LCxxx
         */
         void clearMem();
     private:
+        void startRead( uint32_t startAdr);
         bool writePage( uint32_t startAdr,  uint32_t len, const uint8_t* data);
         uint8_t readStatus();
         void waitForWrite();
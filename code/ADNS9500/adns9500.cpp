@@ -21,17 +21,29 @@
 #include <mbed.h>
 #include <string>
 
+#include <us_ticker_api.h>
 #include <adns9500.hpp>
 
+// Minimum delays between two SPI transactions. They are enforced as
+// deadlines by spiSettle(), so only the part not already spent elsewhere
+// is waited for.
+#define TSRR_US             20      // read to read
+#define TSRW_US             20      // read to write
+#define TSWR_US             120     // write to read
+#define TSWW_US             120     // write to write
+#define TLOAD_US            15      // between two SROM or pixel burst bytes
+// The us ticker only counts whole us, an operation may have ended up to a
+// us after the tick it was stamped with. One tick more covers that part.
+#define TICK_SLACK_US       1
+
+// Bytes written to the SROM by each sromPoll() call. Each one costs at most
+// tLOAD, so this bounds how long a single poll can keep the caller busy.
+#define SROM_BYTES_PER_POLL         8
+
 #define WAIT_TSRAD()        wait_us(100)
-#define WAIT_TSRR()         wait_us(20)
-#define WAIT_TSRW()         wait_us(20)
-#define WAIT_TSWR()         wait_us(120)
-#define WAIT_TSWW()         wait_us(120)
 #define WAIT_TBEXIT()       wait_us(1)      // 500ns
 #define WAIT_TNCSSCLK()     wait_us(1)      // 120ns
 #define WAIT_TSCLKNCS()     wait_us(20)
-#define WAIT_TLOAD()        wait_us(15)
 
 #define LONG_WAIT_MS(x)     \
     WAIT_TSCLKNCS(); ncs_.write(1); wait_ms(x); ncs_.write(0); WAIT_TNCSSCLK()
@@ -40,6 +52,7 @@
 
 #define DEFAULT_MAX_FPS             1958
 #define DEFAULT_MAX_FRAME_PERIOD    (1000000 / DEFAULT_MAX_FPS + 1) // in us
+#define CLOCKS_PER_US               (INTERNAL_OSCILLATOR_FREQUENCY / 1000000)
 #define DEFAULT_X_CPI               1620
 #define DEFAULT_Y_CPI               1620
 #define CPI_CHANGE_UNIT             90
@@ -59,7 +72,17 @@ namespace adns9500 {
           motion_(motion),
           ncs_(ncs),
           enabled_(false),
-          xCpi_(DEFAULT_X_CPI), yCpi_(DEFAULT_Y_CPI)
+          xCpi_(DEFAULT_X_CPI), yCpi_(DEFAULT_Y_CPI),
+          lastOp_(SPI_NONE), lastOpUs_(0),
+          shadowValid_(0), shadowSaved_(0),
+          framePeriodMaxBound_(DEFAULT_FRAME_PERIOD_MAX_BOUND),
+          framePeriodMinBound_(DEFAULT_FRAME_PERIOD_MIN_BOUND),
+          shutterMaxBound_(DEFAULT_SHUTTER_MAX_BOUND),
+          maxFramePeriodUs_(DEFAULT_MAX_FRAME_PERIOD),
+          captureState_(CAPTURE_IDLE), capturePos_(0), captureDeadline_(0),
+          sromState_(SROM_IDLE), sromSource_(NULL), sromChunk_(NULL),
+          sromChunkLen_(0), sromChunkPos_(0), sromLen_(0), sromPos_(0),
+          sromCrc_(-1), sromDeadline_(0), sromCallback_(NULL)
     {
         spi_.format(SPI_BITS_PER_FRAME, SPI_MODE);
         spi_.frequency(spi_frequency);
@@ -83,11 +106,13 @@ namespace adns9500 {
         
         // send 0x5a to POWER_UP_RESET and wait for at least 50ms
         spiSend(POWER_UP_RESET, 0x5a);
+        shadowValid_ = 0;
+        maxFramePeriodUs_ = DEFAULT_MAX_FRAME_PERIOD;
         LONG_WAIT_MS(50);
         
         // clear observation register. Only required to deassert shutdown mode.
         spiSend(OBSERVATION, 0x00);
-        LONG_WAIT_US(DEFAULT_MAX_FRAME_PERIOD);
+        LONG_WAIT_US(maxFramePeriodUs_);
 
         // check observation register bits [5:0]
         int observation = spiReceive(OBSERVATION);
@@ -99,21 +124,14 @@ namespace adns9500 {
         }
 
         // read motion data
-        WAIT_TSRR();
         spiReceive(MOTION);
-        WAIT_TSRR();
         spiReceive(DELTA_X_L);
-        WAIT_TSRR();
         spiReceive(DELTA_X_H);
-        WAIT_TSRR();
         spiReceive(DELTA_Y_L);
-        WAIT_TSRR();
         spiReceive(DELTA_Y_H);
         
         // read product and revision id to test the connection
-        WAIT_TSRR();
         int product_id = spiReceive(PRODUCT_ID);
-        WAIT_TSRR();
         int revision_id = spiReceive(REVISION_ID);
 
         WAIT_TSCLKNCS();
@@ -145,6 +163,7 @@ namespace adns9500 {
         
         // send 0x5a to POWER_UP_RESET
         spiSend(POWER_UP_RESET, 0x5a);
+        shadowValid_ = 0;
         
         WAIT_TSCLKNCS();
         ncs_.write(1);
@@ -152,10 +171,41 @@ namespace adns9500 {
         enabled_ = false;
     }
 
+    void ADNS9500::resync()
+    {
+        if (! enabled_)
+            error("ADNS9500::resync : the sensor is not enabled\n");
+
+        static const Register shadowed[NUMBER_OF_SHADOW_REGISTERS] = {
+            CONFIGURATION_I, CONFIGURATION_II, CONFIGURATION_IV, CONFIGURATION_V,
+            LASER_CTRL0,
+            FRAME_PERIOD_MAX_BOUND_LOWER, FRAME_PERIOD_MAX_BOUND_UPPER,
+            FRAME_PERIOD_MIN_BOUND_LOWER, FRAME_PERIOD_MIN_BOUND_UPPER,
+            SHUTTER_MAX_BOUND_LOWER, SHUTTER_MAX_BOUND_UPPER
+        };
+
+        shadowValid_ = 0;
+
+        ncs_.write(0);
+        WAIT_TNCSSCLK();
+
+        for (int i = 0; i < NUMBER_OF_SHADOW_REGISTERS; i++)
+            configReceive(shadowed[i]);
+
+        WAIT_TSCLKNCS();
+        ncs_.write(1);
+    }
+
     int ADNS9500::read(Register lregister)
     {
         if (! enabled_)
             error("ADNS9500::read : the sensor is not enabled\n");
+
+        int index = shadowIndex(lregister);
+        if (index >= 0 && (shadowValid_ & (1 << index))) {
+            shadowSaved_++;
+            return shadow_[index];
+        }
     
         ncs_.write(0);
         WAIT_TNCSSCLK();
@@ -179,7 +229,6 @@ namespace adns9500 {
 
         // send the command to read the registers
         int lvalue = spiReceive(lregister);
-        WAIT_TSRR();
         int uvalue = spiReceive(uregister);
 
         WAIT_TSCLKNCS();
@@ -189,71 +238,189 @@ namespace adns9500 {
     }
     
     int ADNS9500::sromDownload(const uint8_t* fw, uint16_t fw_len)
+    {
+        sromStart(fw, fw_len);
+        while (sromPoll())
+            ;
+
+        return sromCrc_;
+    }
+
+    int ADNS9500::sromDownload(SromSource* source)
+    {
+        sromStart(source);
+        while (sromPoll())
+            ;
+
+        return sromCrc_;
+    }
+
+    void ADNS9500::sromStart(const uint8_t* fw, uint16_t fw_len, SromCallback callback)
+    {
+        sromFlash_ = FlashSromSource(fw, fw_len);
+        sromStart(&sromFlash_, callback);
+    }
+
+    void ADNS9500::sromStart(SromSource* source, SromCallback callback)
     {
         if (! enabled_)
-            error("ADNS9500::sromDownload : the sensor is not enabled\n");
-    
+            error("ADNS9500::sromStart : the sensor is not enabled\n");
+
+        sromSource_ = source;
+        sromSource_->begin();
+        sromChunk_ = NULL;
+        sromChunkLen_ = 0;
+        sromChunkPos_ = 0;
+        sromLen_ = sromSource_->length();
+        sromPos_ = 0;
+        sromCrc_ = -1;
+        sromCallback_ = callback;
+
         ncs_.write(0);
         WAIT_TNCSSCLK();
 
         // SROM download
-        spiSend(CONFIGURATION_IV, ADNS9500_CONFIGURATION_IV_SROM_SIZE);
-        WAIT_TSWW();
+        configSend(CONFIGURATION_IV, ADNS9500_CONFIGURATION_IV_SROM_SIZE);
         spiSend(SROM_ENABLE, 0x1d);
-        LONG_WAIT_US(DEFAULT_MAX_FRAME_PERIOD);
-
-        spiSend(SROM_ENABLE, 0x18);
-        WAIT_TSWW();
-        spi_.write(SET_BIT(SROM_LOAD_BURST, SPI_WRITE_MODE));
-       
-        for( uint16_t i = 0; i < fw_len; i++){
-            WAIT_TLOAD();
-            spi_.write(fw[i]);
-        }
-        WAIT_TSCLKNCS();
-        ncs_.write(1);
-        WAIT_TBEXIT();
 
-        // test if SROM was downloaded successfully
-        wait_us(160);
-        ncs_.write(0);
-        WAIT_TNCSSCLK();
-        
-        int srom_id = spiReceive(SROM_ID);
-        
-        printf("SROM ID: %x %i\r\n", srom_id, srom_id );
+        // a full frame has to pass before the download starts
         WAIT_TSCLKNCS();
         ncs_.write(1);
-        
-        if (! srom_id)
-            error("ADNS9500::sromDownload : the firmware was not successful downloaded\n");
+        sromDeadline_ = us_ticker_read() + maxFramePeriodUs_;
+        sromState_ = SROM_INIT;
+    }
 
-        // test laser fault condition
-        ncs_.write(0);
-        WAIT_TNCSSCLK();
-        
-        int motion = spiReceive(MOTION);
-        
-        WAIT_TSCLKNCS();
-        ncs_.write(1);
-        
-        if (ADNS9500_IF_LASER_FAULT(motion))
-            error("ADNS9500::sromDownload : laser fault condition detected\n");
-        
-        // return the SROM CRC value
-        ncs_.write(0);
-        WAIT_TNCSSCLK();
-        
-        spiSend(SROM_ENABLE, 0x15);
-        LONG_WAIT_MS(10);
-        
-        int lcrc = spiReceive(DATA_OUT_LOWER);
-        WAIT_TSRR();
-        int ucrc = spiReceive(DATA_OUT_UPPER);
-        
-        WAIT_TSCLKNCS();
-        ncs_.write(1);
-        return ADNS9500_UINT16(ucrc, lcrc);
+    bool ADNS9500::sromPoll()
+    {
+        switch (sromState_) {
+            case SROM_INIT:
+                if (! deadlinePassed(sromDeadline_)) {
+                    // let the source get its first chunk ready meanwhile
+                    sromSource_->idle();
+                    return true;
+                }
+
+                ncs_.write(0);
+                WAIT_TNCSSCLK();
+
+                spiSend(SROM_ENABLE, 0x18);
+                spiSettle(SPI_WRITE);
+                spi_.write(SET_BIT(SROM_LOAD_BURST, SPI_WRITE_MODE));
+
+                // ncs stays low until the whole image is in
+                sromDeadline_ = us_ticker_read() + TLOAD_US + TICK_SLACK_US;
+                sromState_ = SROM_LOAD;
+                return true;
+
+            case SROM_LOAD:
+                for (int n = 0; n < SROM_BYTES_PER_POLL && sromPos_ < sromLen_; n++) {
+                    if (sromChunkPos_ == sromChunkLen_) {
+                        sromChunkLen_ = sromSource_->next(sromChunk_);
+                        sromChunkPos_ = 0;
+                        if (! sromChunkLen_) {
+                            WAIT_TSCLKNCS();
+                            ncs_.write(1);
+                            sromState_ = SROM_IDLE;
+                            error("ADNS9500::sromPoll : the firmware source ended at byte %d\n", sromPos_);
+                        }
+                    }
+
+                    // tLOAD is spent letting the source prefetch, once, so
+                    // a read never runs past the end of the gap
+                    sromSource_->idle();
+                    while (! deadlinePassed(sromDeadline_))
+                        ;
+
+                    spi_.write(sromChunk_[sromChunkPos_++]);
+                    sromPos_++;
+                    sromDeadline_ = us_ticker_read() + TLOAD_US + TICK_SLACK_US;
+                }
+
+                if (sromCallback_)
+                    sromCallback_(sromPos_, sromLen_, -1);
+
+                if (sromPos_ < sromLen_)
+                    return true;
+
+                spiDone(SPI_WRITE);
+                WAIT_TSCLKNCS();
+                ncs_.write(1);
+                WAIT_TBEXIT();
+
+                sromDeadline_ = us_ticker_read() + 160;
+                sromState_ = SROM_VERIFY;
+                return true;
+
+            case SROM_VERIFY:
+            {
+                if (! deadlinePassed(sromDeadline_))
+                    return true;
+
+                // test if SROM was downloaded successfully
+                ncs_.write(0);
+                WAIT_TNCSSCLK();
+
+                int srom_id = spiReceive(SROM_ID);
+
+                printf("SROM ID: %x %i\r\n", srom_id, srom_id );
+                WAIT_TSCLKNCS();
+                ncs_.write(1);
+
+                if (! srom_id)
+                    error("ADNS9500::sromPoll : the firmware was not successful downloaded\n");
+
+                // test laser fault condition
+                ncs_.write(0);
+                WAIT_TNCSSCLK();
+
+                int motion = spiReceive(MOTION);
+
+                WAIT_TSCLKNCS();
+                ncs_.write(1);
+
+                if (ADNS9500_IF_LASER_FAULT(motion))
+                    error("ADNS9500::sromPoll : laser fault condition detected\n");
+
+                // start the SROM CRC test, it takes 10ms
+                ncs_.write(0);
+                WAIT_TNCSSCLK();
+
+                spiSend(SROM_ENABLE, 0x15);
+
+                WAIT_TSCLKNCS();
+                ncs_.write(1);
+                sromDeadline_ = us_ticker_read() + 10000;
+                sromState_ = SROM_CRC;
+                return true;
+            }
+
+            case SROM_CRC:
+            {
+                if (! deadlinePassed(sromDeadline_))
+                    return true;
+
+                ncs_.write(0);
+                WAIT_TNCSSCLK();
+
+                int lcrc = spiReceive(DATA_OUT_LOWER);
+                int ucrc = spiReceive(DATA_OUT_UPPER);
+
+                WAIT_TSCLKNCS();
+                ncs_.write(1);
+
+                sromCrc_ = ADNS9500_UINT16(ucrc, lcrc);
+                sromState_ = SROM_IDLE;
+
+                applyFrameBounds();
+
+                if (sromCallback_)
+                    sromCallback_(sromLen_, sromLen_, sromCrc_);
+                return false;
+            }
+
+            default:
+                return false;
+        }
     }
 
     void ADNS9500::enableLaser(bool enable)
@@ -265,19 +432,15 @@ namespace adns9500 {
         ncs_.write(0);
         WAIT_TNCSSCLK();
 
-        int laser_ctrl0 = spiReceive(LASER_CTRL0);
-        
-        ncs_.write(0);
-        WAIT_TNCSSCLK();
+        // bits [3:1] must be written as zero, the upper ones are kept
+        int laser_ctrl0 = configReceive(LASER_CTRL0) & 0xf0;
   
-        if (enable) {
-            int laser_ctrl0 = CLEAR_BIT(0x00, ADNS9500_LASER_CTRL0_FORCE_DISABLED);
-            spiSend(LASER_CTRL0, laser_ctrl0);
-        }
-        else {
-            int laser_ctrl0 = SET_BIT(0x01, ADNS9500_LASER_CTRL0_FORCE_DISABLED);
-            spiSend(LASER_CTRL0, laser_ctrl0);
-        }        
+        if (enable)
+            laser_ctrl0 = CLEAR_BIT(laser_ctrl0, ADNS9500_LASER_CTRL0_FORCE_DISABLED);
+        else
+            laser_ctrl0 = SET_BIT(laser_ctrl0, ADNS9500_LASER_CTRL0_FORCE_DISABLED);
+
+        configSend(LASER_CTRL0, laser_ctrl0);
 
         WAIT_TSCLKNCS();
         ncs_.write(1);
@@ -297,15 +460,10 @@ namespace adns9500 {
         int motion = spiReceive(MOTION);
         
         if (ADNS9500_IF_MOTION(motion)) {
-            WAIT_TSRR();
             int dxl = spiReceive(DELTA_X_L);
-            WAIT_TSRR();
             dx = ADNS9500_INT16(spiReceive(DELTA_X_H), dxl);
             
-            WAIT_TSRR();
-            
             int dyl = spiReceive(DELTA_Y_L);
-            WAIT_TSRR();
             dy = ADNS9500_INT16(spiReceive(DELTA_Y_H), dyl);
         }
         WAIT_TSCLKNCS();
@@ -324,6 +482,63 @@ namespace adns9500 {
         return motion;
     }
 
+    bool ADNS9500::getMotionBurst(MotionBurst& burst, MotionBurstStats* stats)
+    {
+        if (! enabled_)
+            error("ADNS9500::getMotionBurst : the sensor is not enabled\n");
+
+        ncs_.write(0);
+        WAIT_TNCSSCLK();
+
+        // activate motion burst mode
+        spiSettle(SPI_READ);
+        spi_.write(MOTION_BURST);
+        WAIT_TSRAD();
+
+        // motion, observation, delta x, delta y and squal. Unless the stats
+        // are wanted the rest of the burst is skipped by raising ncs.
+        int motion = spi_.write(0x00);
+        spi_.write(0x00);
+
+        int ldx = spi_.write(0x00);
+        int udx = spi_.write(0x00);
+        int ldy = spi_.write(0x00);
+        int udy = spi_.write(0x00);
+
+        burst.squal = spi_.write(0x00);
+
+        if (stats) {
+            stats->pixelSum = spi_.write(0x00);
+            stats->maximumPixel = spi_.write(0x00);
+            stats->minimumPixel = spi_.write(0x00);
+
+            int ushutter = spi_.write(0x00);
+            stats->shutter = ADNS9500_UINT16(ushutter, spi_.write(0x00));
+
+            int uframe_period = spi_.write(0x00);
+            stats->framePeriod = ADNS9500_UINT16(uframe_period, spi_.write(0x00));
+        }
+        spiDone(SPI_READ);
+
+        WAIT_TSCLKNCS();
+        ncs_.write(1);
+        WAIT_TBEXIT();
+
+        burst.motion = motion;
+        burst.overflow = ADNS9500_IF_OVERFLOW(motion);
+
+        if (ADNS9500_IF_MOTION(motion)) {
+            burst.dx = ADNS9500_INT16(udx, ldx);
+            burst.dy = ADNS9500_INT16(udy, ldy);
+        }
+        else {
+            burst.dx = 0;
+            burst.dy = 0;
+        }
+
+        return ADNS9500_IF_MOTION(motion);
+    }
+
     bool ADNS9500::getMotionData(MotionData& data)
     {
         if (! enabled_)
@@ -333,7 +548,8 @@ namespace adns9500 {
         WAIT_TNCSSCLK();
         
         // activate motion burst mode
-        spi_.write(0x50);
+        spiSettle(SPI_READ);
+        spi_.write(MOTION_BURST);
         WAIT_TSRAD();   // see the chronogram
         
         // read motion burst data
@@ -356,6 +572,7 @@ namespace adns9500 {
         
         int uframe_period = spi_.write(0x00);
         data.framePeriod = ADNS9500_UINT16(uframe_period, spi_.write(0x00));
+        spiDone(SPI_READ);
 
         WAIT_TSCLKNCS();
         ncs_.write(1);
@@ -388,14 +605,12 @@ namespace adns9500 {
         WAIT_TNCSSCLK();
         
         // enable XY axes CPI in sync mode
-        int rpt_mod = spiReceive(CONFIGURATION_II);
+        int rpt_mod = configReceive(CONFIGURATION_II);
         rpt_mod = CLEAR_BIT(rpt_mod, ADNS9500_CONFIGURATION_II_RPT_MOD);
-        WAIT_TSRW();
-        spiSend(CONFIGURATION_II, rpt_mod);
+        configSend(CONFIGURATION_II, rpt_mod);
 
         // set resolution for X-axis and Y-axis
-        WAIT_TSWW();
-        spiSend(CONFIGURATION_I, res_xy);
+        configSend(CONFIGURATION_I, res_xy);
 
         WAIT_TSCLKNCS();
         ncs_.write(1);
@@ -405,29 +620,28 @@ namespace adns9500 {
     }
     
     void ADNS9500::setResolution(uint16_t cpi_x, uint16_t cpi_y)
+    {
+        setResolutionRegisters(cpi_to_res(cpi_x), cpi_to_res(cpi_y));
+    }
+
+    void ADNS9500::setResolutionRegisters(int res_x, int res_y)
     {
         if (! enabled_)
             error("ADNS9500::setResolution : the sensor is not enabled\n");
-        
-        int res_x = cpi_to_res(cpi_x);
-        int res_y = cpi_to_res(cpi_y);
            
         ncs_.write(0);
         WAIT_TNCSSCLK();
 
         // disable XY axes CPI in sync mode
-        int rpt_mod = spiReceive(CONFIGURATION_II);
+        int rpt_mod = configReceive(CONFIGURATION_II);
         rpt_mod = SET_BIT(rpt_mod, ADNS9500_CONFIGURATION_II_RPT_MOD);
-        WAIT_TSRW();
-        spiSend(CONFIGURATION_II, rpt_mod);
+        configSend(CONFIGURATION_II, rpt_mod);
         
         // set resolution for X-axis
-        WAIT_TSWW();
-        spiSend(CONFIGURATION_I, res_x);
+        configSend(CONFIGURATION_I, res_x);
                 
         // set resolution for Y-axis
-        WAIT_TSWW();
-        spiSend(CONFIGURATION_V, res_y);
+        configSend(CONFIGURATION_V, res_y);
 
         WAIT_TSCLKNCS();
         ncs_.write(1);
@@ -436,50 +650,274 @@ namespace adns9500 {
         yCpi_ = res_y * CPI_CHANGE_UNIT;
     }
     
+    bool ADNS9500::setFrameBounds(uint16_t min_fps, uint16_t max_fps, uint16_t shutter_max)
+    {
+        if (! enabled_)
+            error("ADNS9500::setFrameBounds : the sensor is not enabled\n");
+
+        // a bad range comes from the settings, clamp it rather than halt
+        bool valid = min_fps && max_fps && min_fps <= max_fps;
+        if (! max_fps)
+            max_fps = 0xffff;
+        if (! min_fps)
+            min_fps = 1;
+        if (min_fps > max_fps)
+            min_fps = max_fps;
+
+        uint32_t max_period = INTERNAL_OSCILLATOR_FREQUENCY / min_fps;
+        uint32_t min_period = INTERNAL_OSCILLATOR_FREQUENCY / max_fps;
+
+        if (max_period > 0xffff)
+            max_period = 0xffff;
+        if (min_period < MIN_FRAME_PERIOD)
+            min_period = MIN_FRAME_PERIOD;
+        if (max_period < min_period)
+            max_period = min_period;
+        if (shutter_max > max_period - min_period)
+            shutter_max = max_period - min_period;
+
+        framePeriodMaxBound_ = max_period;
+        framePeriodMinBound_ = min_period;
+        shutterMaxBound_ = shutter_max;
+
+        // a running download would be corrupted, it applies them at its end
+        if (sromState_ == SROM_IDLE)
+            applyFrameBounds();
+
+        return valid;
+    }
+
+    void ADNS9500::setRestMode(RestMode mode)
+    {
+        if (! enabled_)
+            error("ADNS9500::setRestMode : the sensor is not enabled\n");
+
+        ncs_.write(0);
+        WAIT_TNCSSCLK();
+
+        int config = configReceive(CONFIGURATION_II);
+        config = CLEAR_BIT(config, ADNS9500_CONFIGURATION_II_F_REST) | (mode << 6);
+        configSend(CONFIGURATION_II, config);
+
+        WAIT_TSCLKNCS();
+        ncs_.write(1);
+    }
+
+    void ADNS9500::applyFrameBounds()
+    {
+        ncs_.write(0);
+        WAIT_TNCSSCLK();
+
+        // the max bound has to be written last, it makes all three take effect,
+        // so it is written again whenever one of the others changed
+        bool changed = configSend16(FRAME_PERIOD_MIN_BOUND_UPPER, FRAME_PERIOD_MIN_BOUND_LOWER, framePeriodMinBound_);
+        changed |= configSend16(SHUTTER_MAX_BOUND_UPPER, SHUTTER_MAX_BOUND_LOWER, shutterMaxBound_);
+        configSend16(FRAME_PERIOD_MAX_BOUND_UPPER, FRAME_PERIOD_MAX_BOUND_LOWER, framePeriodMaxBound_, changed);
+
+        WAIT_TSCLKNCS();
+        ncs_.write(1);
+
+        maxFramePeriodUs_ = framePeriodMaxBound_ / CLOCKS_PER_US + 1;
+    }
+
     void ADNS9500::captureFrame(uint8_t* pixels)
     {
         if (! enabled_)
             error("ADNS9500::captureFrame : the sensor is not enabled\n");
-            
+
+        captureStart();
+
+        int count = 0;
+        while (count < NUMBER_OF_PIXELS_PER_FRAME)
+            count += captureRead(pixels + count, NUMBER_OF_PIXELS_PER_FRAME - count);
+    }
+
+    void ADNS9500::captureStart()
+    {
+        if (! enabled_)
+            error("ADNS9500::captureStart : the sensor is not enabled\n");
+
         ncs_.write(0);
         WAIT_TNCSSCLK();
-        
+
         spiSend(FRAME_CAPTURE, 0x93);
-        WAIT_TSWW();
         spiSend(FRAME_CAPTURE, 0xc5);
-        LONG_WAIT_US(2*DEFAULT_MAX_FRAME_PERIOD);
 
-        // check for first pixel reading motion bit
-        int motion = spiReceive(MOTION);
-        WAIT_TSRR();
-        while(! ADNS9500_IF_FRAME_FIRST_PIXEL(motion)) {
+        // the frame is ready two frames later
+        WAIT_TSCLKNCS();
+        ncs_.write(1);
+        captureDeadline_ = us_ticker_read() + 2*maxFramePeriodUs_;
+        capturePos_ = 0;
+        captureState_ = CAPTURE_WAIT;
+    }
+
+    int ADNS9500::captureRead(uint8_t* pixels, int count)
+    {
+        if (captureState_ == CAPTURE_WAIT) {
+            if (! deadlinePassed(captureDeadline_))
+                return 0;
+
+            ncs_.write(0);
+            WAIT_TNCSSCLK();
+
+            // check for first pixel reading motion bit
             int motion = spiReceive(MOTION);
-            WAIT_TSRR();
+            if (! ADNS9500_IF_FRAME_FIRST_PIXEL(motion)) {
+                WAIT_TSCLKNCS();
+                ncs_.write(1);
+                return 0;
+            }
+
+            // start the pixel burst, ncs stays low until the last pixel
+            spiSettle(SPI_READ);
+            spi_.write(PIXEL_BURST);
+            WAIT_TSRAD();
+            captureDeadline_ = us_ticker_read();
+            captureState_ = CAPTURE_BURST;
         }
 
-        // read pixel values
-        spi_.write(PIXEL_BURST);
-        WAIT_TSRAD();
-        for (uint8_t* p = pixels; p != pixels + NUMBER_OF_PIXELS_PER_FRAME; ++p) {
-            *p = spi_.write(0x00);
-            WAIT_TLOAD();
+        if (captureState_ != CAPTURE_BURST)
+            return 0;
+
+        // tLOAD runs from the end of the previous pixel, time spent by the
+        // caller between two calls counts towards it
+        int n = 0;
+        while (n < count && capturePos_ < NUMBER_OF_PIXELS_PER_FRAME) {
+            while (! deadlinePassed(captureDeadline_))
+                ;
+            pixels[n++] = spi_.write(0x00);
+            capturePos_++;
+            captureDeadline_ = us_ticker_read() + TLOAD_US + TICK_SLACK_US;
         }
 
-        // burst exit
-        ncs_.write(1);
-        WAIT_TBEXIT();
+        if (capturePos_ == NUMBER_OF_PIXELS_PER_FRAME) {
+            spiDone(SPI_READ);
+
+            // burst exit
+            ncs_.write(1);
+            WAIT_TBEXIT();
+            captureState_ = CAPTURE_IDLE;
+        }
+
+        return n;
     }
     
     void ADNS9500::spiSend(Register address, int value)
     {
+        spiSettle(SPI_WRITE);
         spi_.write(SET_BIT(address, SPI_WRITE_MODE));
         spi_.write(value);
+        spiDone(SPI_WRITE);
     }
 
     int ADNS9500::spiReceive(Register address)
     {
+        spiSettle(SPI_READ);
         spi_.write(CLEAR_BIT(address, SPI_WRITE_MODE));
         WAIT_TSRAD();
-        return spi_.write(0x00);
+        int value = spi_.write(0x00);
+        spiDone(SPI_READ);
+        return value;
+    }
+
+    int ADNS9500::shadowIndex(Register address)
+    {
+        switch (address) {
+            case CONFIGURATION_I:               return 0;
+            case CONFIGURATION_II:              return 1;
+            case CONFIGURATION_IV:              return 2;
+            case CONFIGURATION_V:               return 3;
+            case LASER_CTRL0:                   return 4;
+            case FRAME_PERIOD_MAX_BOUND_LOWER:  return 5;
+            case FRAME_PERIOD_MAX_BOUND_UPPER:  return 6;
+            case FRAME_PERIOD_MIN_BOUND_LOWER:  return 7;
+            case FRAME_PERIOD_MIN_BOUND_UPPER:  return 8;
+            case SHUTTER_MAX_BOUND_LOWER:       return 9;
+            case SHUTTER_MAX_BOUND_UPPER:       return 10;
+            default:                            return -1;
+        }
+    }
+
+    int ADNS9500::configReceive(Register address)
+    {
+        int index = shadowIndex(address);
+        if (index < 0)
+            return spiReceive(address);
+
+        if (shadowValid_ & (1 << index)) {
+            shadowSaved_++;
+            return shadow_[index];
+        }
+
+        shadow_[index] = spiReceive(address);
+        shadowValid_ |= 1 << index;
+        return shadow_[index];
+    }
+
+    void ADNS9500::configSend(Register address, int value)
+    {
+        int index = shadowIndex(address);
+        if (index < 0) {
+            spiSend(address, value);
+            return;
+        }
+
+        if ((shadowValid_ & (1 << index)) && shadow_[index] == (value & 0xff)) {
+            shadowSaved_++;
+            return;
+        }
+
+        spiSend(address, value);
+        shadow_[index] = value;
+        shadowValid_ |= 1 << index;
+    }
+
+    bool ADNS9500::configSend16(Register uregister, Register lregister, uint16_t value, bool force)
+    {
+        int uindex = shadowIndex(uregister);
+        int lindex = shadowIndex(lregister);
+        int both = (1 << uindex) | (1 << lindex);
+
+        if (!force && (shadowValid_ & both) == both
+            && ADNS9500_UINT16(shadow_[uindex], shadow_[lindex]) == value) {
+            shadowSaved_ += 2;
+            return false;
+        }
+
+        spiSend(lregister, value & 0xff);
+        spiSend(uregister, value >> 8);
+        shadow_[lindex] = value & 0xff;
+        shadow_[uindex] = value >> 8;
+        shadowValid_ |= both;
+        return true;
+    }
+
+    void ADNS9500::spiSettle(SpiOperation next)
+    {
+        uint32_t required;
+
+        if (lastOp_ == SPI_READ)
+            required = (next == SPI_READ) ? TSRR_US : TSRW_US;
+        else if (lastOp_ == SPI_WRITE)
+            required = (next == SPI_READ) ? TSWR_US : TSWW_US;
+        else
+            return;
+        required += TICK_SLACK_US;
+
+        // unsigned arithmetic keeps this right across a ticker wrap
+        uint32_t elapsed = us_ticker_read() - lastOpUs_;
+        if (elapsed < required)
+            wait_us(required - elapsed);
+    }
+
+    bool ADNS9500::deadlinePassed(uint32_t deadline)
+    {
+        return (int32_t)(us_ticker_read() - deadline) >= 0;
+    }
+
+    void ADNS9500::spiDone(SpiOperation op)
+    {
+        lastOp_ = op;
+        lastOpUs_ = us_ticker_read();
     }
 }
\ No newline at end of file
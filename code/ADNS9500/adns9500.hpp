@@ -25,12 +25,14 @@
 #include "adns9500_firmware.hpp"
 
 #define ADNS9500_CONFIGURATION_II_RPT_MOD   (1 << 2)
+#define ADNS9500_CONFIGURATION_II_F_REST    (3 << 6)
 #define ADNS9500_CONFIGURATION_IV_SROM_SIZE (1 << 1)
 #define ADNS9500_LASER_CTRL0_FORCE_DISABLED (1 << 0)
 #define ADNS9500_OBSERVATION_CHECK_BITS     0x3f
 
 #define ADNS9500_IF_MOTION(x)               (bool)(x & 0x80)
 #define ADNS9500_IF_LASER_FAULT(x)          (bool)(x & 0x40)
+#define ADNS9500_IF_OVERFLOW(x)             (bool)(x & 0x10)
 #define ADNS9500_IF_RUNNING_SROM_CODE(x)    (bool)(x & 0x80)
 #define ADNS9500_IF_FRAME_FIRST_PIXEL(x)    (bool)(x & 0x01)
 #define ADNS9500_IF_OBSERVATION_TEST(x)     (bool)(x & ADNS9500_OBSERVATION_CHECK_BITS)
@@ -55,6 +57,14 @@ namespace adns9500
     
     // Internal oscillator norminal frequency
     const int INTERNAL_OSCILLATOR_FREQUENCY = 47000000;
+
+    // Frame period and shutter bounds after power up, in oscillator clocks
+    const int DEFAULT_FRAME_PERIOD_MAX_BOUND = 24000;  // 1958 fps
+    const int DEFAULT_FRAME_PERIOD_MIN_BOUND = 4000;   // 11750 fps
+    const int DEFAULT_SHUTTER_MAX_BOUND = 20000;
+
+    // Shortest frame period the sensor supports, in oscillator clocks
+    const int MIN_FRAME_PERIOD = 4000;
     
     // Number of pixels per frame
     const int NUMBER_OF_PIXELS_PER_FRAME = 900;
@@ -62,6 +72,9 @@ namespace adns9500
     // Maximum surface quality
     const int MAX_SURFACE_QUALITY = 676;    // 169 * 4
 
+    // Number of configuration registers kept in the driver shadow
+    const int NUMBER_OF_SHADOW_REGISTERS = 11;
+
     //
     // Sensor registers
     //
@@ -87,6 +100,12 @@ namespace adns9500
         CONFIGURATION_II   = 0x10,
         FRAME_CAPTURE      = 0x12,
         SROM_ENABLE        = 0x13,
+        FRAME_PERIOD_MAX_BOUND_LOWER = 0x1a,
+        FRAME_PERIOD_MAX_BOUND_UPPER = 0x1b,
+        FRAME_PERIOD_MIN_BOUND_LOWER = 0x1c,
+        FRAME_PERIOD_MIN_BOUND_UPPER = 0x1d,
+        SHUTTER_MAX_BOUND_LOWER      = 0x1e,
+        SHUTTER_MAX_BOUND_UPPER      = 0x1f,
         LASER_CTRL0        = 0x20,
         DATA_OUT_LOWER     = 0x25,
         DATA_OUT_UPPER     = 0x26,
@@ -100,6 +119,18 @@ namespace adns9500
         PIXEL_BURST        = 0x64
     };
 
+    //
+    // Rest modes, as set in the F_REST bits of CONFIGURATION_II
+    //
+
+    enum RestMode
+    {
+        REST_NONE = 0x00,   // normal operation
+        REST_1    = 0x01,
+        REST_2    = 0x02,
+        REST_3    = 0x03    // lowest power, slowest to notice motion
+    };
+
     //
     // Supported resolutions
     //
@@ -138,6 +169,131 @@ namespace adns9500
         int framePeriod;
     };
 
+    //
+    // Short motion burst data. Only the leading bytes of the burst are
+    // clocked out so it is cheap enough to read on every poll
+    //
+
+    struct MotionBurst
+    {
+        MotionBurst()
+            : motion(0), overflow(false), dx(0), dy(0), squal(0)
+        {}
+
+        uint8_t motion;
+        bool overflow;
+        int16_t dx;
+        int16_t dy;
+        uint8_t squal;
+    };
+
+    //
+    // Rest of the motion burst, in raw register units. Read only when asked
+    // for, it costs seven more bytes on the bus
+    //
+
+    struct MotionBurstStats
+    {
+        MotionBurstStats()
+            : pixelSum(0), maximumPixel(0), minimumPixel(0), shutter(0),
+              framePeriod(0)
+        {}
+
+        uint8_t pixelSum;
+        uint8_t maximumPixel;
+        uint8_t minimumPixel;
+        uint16_t shutter;
+        uint16_t framePeriod;
+    };
+
+    //
+    // SROM download progress callback
+    //
+    // @param loaded Number of firmware bytes already written to the sensor
+    // @param total Length of the firmware
+    // @param crc The SROM CRC once the download has finished, -1 until then
+    //
+    typedef void (*SromCallback)(uint16_t loaded, uint16_t total, int crc);
+
+    //
+    // Source of the firmware written to the sensor SROM. The download pulls
+    // it in chunks, so it never has to be held in RAM as a whole
+    //
+
+    class SromSource
+    {
+        public:
+
+            virtual ~SromSource() {}
+
+            //
+            // Get the length of the firmware
+            //
+            // @return The length of the firmware in bytes
+            //
+            virtual uint16_t length() = 0;
+
+            //
+            // Rewind the source to the start of the firmware. Called by
+            // sromStart() before anything is read
+            //
+            virtual void begin() {}
+
+            //
+            // Get the next chunk of the firmware
+            //
+            // @param chunk Set to the chunk. It must stay valid until the next call
+            // @return The number of bytes in the chunk, or 0 if nothing is left
+            //
+            virtual uint16_t next(const uint8_t*& chunk) = 0;
+
+            //
+            // Called once in each tLOAD gap between two SROM bytes, and
+            // repeatedly while the download waits for the first frame.
+            // Sources which are slow to read prefetch their next chunk here.
+            // Each call must take less than tLOAD, or it stretches the gap
+            //
+            virtual void idle() {}
+    };
+
+    //
+    // Firmware held in memory, usually compiled into flash
+    //
+
+    class FlashSromSource : public SromSource
+    {
+        public:
+
+            //
+            // @param fw The sensor firmware
+            // @param fw_len The length of the firmware
+            //
+            FlashSromSource(const uint8_t* fw = NULL, uint16_t fw_len = 0)
+                : fw_(fw), len_(fw_len), done_(false)
+            {}
+
+            virtual uint16_t length()
+                { return len_; }
+
+            virtual void begin()
+                { done_ = false; }
+
+            virtual uint16_t next(const uint8_t*& chunk)
+            {
+                if (done_)
+                    return 0;
+                done_ = true;
+                chunk = fw_;
+                return len_;
+            }
+
+        private:
+
+            const uint8_t* fw_;
+            uint16_t len_;
+            bool done_;
+    };
+
     //
     // Interface to access to ADNS-9500 mouse sensor
     //
@@ -180,7 +336,8 @@ namespace adns9500
             void shutdown();
 
             //
-            // Read the value of a sensor register
+            // Read the value of a sensor register. Configuration registers
+            // are answered from the shadow without touching the bus
             //
             // @param lregister The register which to read its value
             // @return The value of the register
@@ -198,6 +355,22 @@ namespace adns9500
             //
             int read(Register uregister, Register lregister);
 
+            //
+            // Reload the shadow of the configuration registers from the sensor.
+            // reset() and shutdown() drop the shadow, after them it is refilled
+            // register by register on first use unless this is called
+            //
+            void resync();
+
+            //
+            // Get the number of SPI transactions the shadow has saved so far
+            //
+            // @return Reads answered from the shadow plus writes skipped because
+            //         the register already held the value
+            //
+            uint32_t shadowSaved()
+                { return shadowSaved_; }
+
             //
             // Get information about sensor status
             //
@@ -216,6 +389,52 @@ namespace adns9500
             //
             int sromDownload(const uint8_t*, uint16_t);
 
+            //
+            // Download the firmware to the sensor SROM
+            //
+            // @param source Where the firmware is read from
+            // @return The SROM CRC value
+            //
+            int sromDownload(SromSource* source);
+
+            //
+            // Start downloading the firmware to the sensor SROM without blocking.
+            // The download is advanced by calling sromPoll() until it returns
+            // false. No other sensor access may be done in the meantime
+            //
+            // @param fw The sensor firmware
+            // @param fw_len The length of the firmware
+            // @param callback Function called with the progress and the final CRC,
+            //                 or NULL
+            //
+            void sromStart(const uint8_t* fw, uint16_t fw_len, SromCallback callback = NULL);
+
+            //
+            // Start downloading the firmware to the sensor SROM without blocking,
+            // reading it from a chunked source. The source must outlive the download
+            //
+            // @param source Where the firmware is read from
+            // @param callback Function called with the progress and the final CRC,
+            //                 or NULL
+            //
+            void sromStart(SromSource* source, SromCallback callback = NULL);
+
+            //
+            // Advance a download started by sromStart(). Each call writes at most a
+            // few bytes and never waits for the long frame or CRC delays
+            //
+            // @return True while the download is still in progress
+            //
+            bool sromPoll();
+
+            //
+            // Get the SROM CRC of the last download
+            //
+            // @return The SROM CRC value, or -1 if no download has finished
+            //
+            int sromCrc()
+                { return sromCrc_; }
+
             //
             // Enable the laser
             //
@@ -243,6 +462,30 @@ namespace adns9500
             //         or false in other case
             //
             bool getMotionDeltaMM(float& dx, float& dy);
+
+            //
+            // Get motion deltas and surface quality using a single motion burst
+            // read. Only one address phase and one tSRAD wait are needed, which
+            // makes it much cheaper than getMotionDelta()
+            //
+            // @param burst The struct where the burst data will be stored
+            // @return True if motion was occurred since the last time the function was called,
+            //         or false in other case
+            //
+            bool getMotionBurst(MotionBurst& burst)
+                { return getMotionBurst(burst, NULL); }
+
+            //
+            // Get motion deltas and surface quality using a single motion burst
+            // read, optionally clocking out the rest of the burst as well
+            //
+            // @param burst The struct where the burst data will be stored
+            // @param stats The struct where the pixel, shutter and frame period data
+            //              will be stored, or NULL to stop after the surface quality
+            // @return True if motion was occurred since the last time the function was called,
+            //         or false in other case
+            //
+            bool getMotionBurst(MotionBurst& burst, MotionBurstStats* stats);
             
             //
             // Get all information about motion
@@ -268,6 +511,50 @@ namespace adns9500
             //
             void setResolution(uint16_t x_resolution, uint16_t y_resolution);
 
+            //
+            // Set the resolutions from register values worked out beforehand
+            // with cpi_to_res()
+            //
+            // @param res_x The CONFIGURATION_I value for X-axis
+            // @param res_y The CONFIGURATION_V value for Y-axis
+            //
+            void setResolutionRegisters(int res_x, int res_y);
+
+            //
+            // Set the range the automatic frame rate moves in and the longest
+            // shutter time. The values are remembered and applied again after
+            // every SROM download. While a download is running they are only
+            // applied at its end
+            //
+            // Shutter_max is clipped so the longest frame still fits it, as
+            // the sensor requires max_period >= min_period + shutter_max
+            //
+            // @param min_fps Lowest frame rate, sets Frame_Period_Max_Bound
+            // @param max_fps Highest frame rate, sets Frame_Period_Min_Bound
+            // @param shutter_max Longest shutter time in oscillator clocks
+            //
+            // @return false if the range was empty or had a zero rate, it was
+            // clamped to the closest one the sensor can do
+            //
+            bool setFrameBounds(uint16_t min_fps, uint16_t max_fps, uint16_t shutter_max);
+
+            //
+            // Force the sensor into a rest mode, or back to normal operation.
+            // Motion is still detected in rest modes and asserts the motion
+            // pin, at the slower frame rate of the mode
+            //
+            // @param mode The rest mode, REST_NONE for normal operation
+            //
+            void setRestMode(RestMode mode);
+
+            //
+            // Get the longest frame period the sensor can currently run at
+            //
+            // @return The frame period in us, rounded up
+            //
+            int maxFramePeriodUs()
+                { return maxFramePeriodUs_; }
+
             //
             // Get a full array of pixel values from a single frame.
             // This disables navigation and overwrites any donwloaded firmware,
@@ -277,6 +564,32 @@ namespace adns9500
             //
             void captureFrame(uint8_t* pixels);
 
+            //
+            // Start capturing a frame without blocking. The pixels are then
+            // collected by calling captureRead() until the whole frame is in.
+            // Like captureFrame(), it disables navigation until reset() is called
+            //
+            void captureStart();
+
+            //
+            // Read the next pixels of a frame started by captureStart(). ncs is
+            // held low between calls while the pixel burst is in progress, so no
+            // other sensor access may be done until the frame is complete
+            //
+            // @param pixels Where the next pixel values will be stored
+            // @param count The maximum number of pixels to read in this call
+            // @return The number of pixels stored, 0 while the frame is not ready
+            //
+            int captureRead(uint8_t* pixels, int count);
+
+            //
+            // Check if a frame started by captureStart() is still being read
+            //
+            // @return True until the last pixel has been read
+            //
+            bool capturing()
+                { return captureState_ != CAPTURE_IDLE; }
+
             //
             // Member function invoked when motion has ocurred and if a motion pin
             // was specified when the object constructor was called.
@@ -303,6 +616,15 @@ namespace adns9500
             void attach(T& object, void (T::*member)(void))
                 { motionTrigger_.attach(object, member); }
 
+            //
+            // Check the level of the motion pin. Only meaningful if a motion pin
+            // was specified when the object constructor was called
+            //
+            // @return True if the sensor is still asserting the motion pin
+            //
+            bool motionPending()
+                { return ! motion_.read(); }
+
             int cpi_to_res( uint16_t cpi ){
                 int res = cpi / 90;
         
@@ -324,6 +646,75 @@ namespace adns9500
             int xCpi_, yCpi_;
             
             FunctionPointer motionTrigger_;
+
+            //
+            // Kind of SPI transaction, used to pick which of the tSRR, tSRW,
+            // tSWR or tSWW delays applies between two transactions
+            //
+            enum SpiOperation
+            {
+                SPI_NONE,
+                SPI_READ,
+                SPI_WRITE
+            };
+
+            SpiOperation lastOp_;
+            uint32_t lastOpUs_;
+
+            //
+            // Steps of a non-blocking SROM download
+            //
+            enum SromState
+            {
+                SROM_IDLE,
+                SROM_INIT,      // waiting a frame after enabling the download
+                SROM_LOAD,      // streaming the image, ncs held low
+                SROM_VERIFY,    // waiting before checking the SROM id
+                SROM_CRC        // waiting for the SROM CRC test
+            };
+
+            //
+            // Last known values of the configuration registers. A bit set in
+            // shadowValid_ means the matching entry is known to be current
+            //
+            uint8_t shadow_[NUMBER_OF_SHADOW_REGISTERS];
+            uint16_t shadowValid_;
+            uint32_t shadowSaved_;
+
+            //
+            // Frame bounds requested by setFrameBounds(), in oscillator clocks,
+            // and the longest frame period currently in effect on the sensor
+            //
+            uint16_t framePeriodMaxBound_;
+            uint16_t framePeriodMinBound_;
+            uint16_t shutterMaxBound_;
+            int maxFramePeriodUs_;
+
+            //
+            // Steps of a non-blocking frame capture
+            //
+            enum CaptureState
+            {
+                CAPTURE_IDLE,
+                CAPTURE_WAIT,   // waiting for the frame to be taken
+                CAPTURE_BURST   // reading pixels, ncs held low
+            };
+
+            CaptureState captureState_;
+            int capturePos_;
+            uint32_t captureDeadline_;
+
+            SromState sromState_;
+            FlashSromSource sromFlash_;
+            SromSource* sromSource_;
+            const uint8_t* sromChunk_;
+            uint16_t sromChunkLen_;
+            uint16_t sromChunkPos_;
+            uint16_t sromLen_;
+            uint16_t sromPos_;
+            int sromCrc_;
+            uint32_t sromDeadline_;
+            SromCallback sromCallback_;
             
             //
             // Write a byte to the specified register
@@ -340,6 +731,75 @@ namespace adns9500
             // @return The value of the register
             //
             int spiReceive(Register address);
+
+            //
+            // Get where a register is kept in the shadow
+            //
+            // @param address The register address
+            // @return The shadow index, or -1 if the register is not shadowed
+            //
+            static int shadowIndex(Register address);
+
+            //
+            // Read a configuration register, from the shadow if it is current.
+            // ncs must already be low
+            //
+            // @param address The register address
+            // @return The value of the register
+            //
+            int configReceive(Register address);
+
+            //
+            // Write a configuration register, skipping the bus if the shadow
+            // says it already holds the value. ncs must already be low
+            //
+            // @param address The register address
+            // @param value The value to be written to the register
+            //
+            void configSend(Register address, int value);
+
+            //
+            // Write a 16-bit configuration register pair, lower byte first.
+            // Both bytes are written if either changed, the sensor only takes
+            // the new value when the upper byte is written. ncs must already
+            // be low
+            //
+            // @param uregister The register of the upper byte
+            // @param lregister The register of the lower byte
+            // @param value The value to be written
+            // @param force Write the pair even if the shadow already holds value
+            // @return true if the pair was written
+            //
+            bool configSend16(Register uregister, Register lregister, uint16_t value, bool force = false);
+
+            //
+            // Write the frame bounds to the sensor
+            //
+            void applyFrameBounds();
+
+            //
+            // Wait for whatever is still missing of the minimum delay between
+            // the last SPI transaction and the next one. Time spent elsewhere
+            // since the last transaction counts towards it
+            //
+            // @param next The kind of transaction about to start
+            //
+            void spiSettle(SpiOperation next);
+
+            //
+            // Timestamp the end of a SPI transaction
+            //
+            // @param op The kind of transaction which just finished
+            //
+            void spiDone(SpiOperation op);
+
+            //
+            // Check if a microsecond deadline has been reached
+            //
+            // @param deadline The deadline, as a us_ticker_read() value
+            // @return True if the deadline is now or in the past
+            //
+            bool deadlinePassed(uint32_t deadline);
     };
 }
 
@@ -703,12 +703,15 @@ bool USBDevice::configured(void)
     return (device.state == CONFIGURED);
 }
 
-void USBDevice::connect(void)
+void USBDevice::connect(bool blocking)
 {
     /* Connect device */
     USBHAL::connect();
-    /* Block if not configured */
-    while (!configured());
+
+    if (blocking) {
+        /* Block if not configured */
+        while (!configured());
+    }
 }
 
 void USBDevice::disconnect(void)
@@ -786,6 +789,16 @@ void USBDevice::connectStateChanged(unsigned int connected)
 
 void USBDevice::suspendStateChanged(unsigned int suspended)
 {
+    if (device.suspended == (suspended != 0))
+    {
+        return;
+    }
+    device.suspended = (suspended != 0);
+
+    if (suspendCallback != NULL)
+    {
+        suspendCallback(device.suspended);
+    }
 }
 
 
@@ -798,6 +811,7 @@ USBDevice::USBDevice(uint16_t vendor_id, uint16_t product_id, uint16_t product_r
     device.state = POWERED;
     device.configuration = 0;
     device.suspended = false;
+    suspendCallback = NULL;
 };
 
 
@@ -34,11 +34,28 @@ public:
     * @returns true if configured, false otherwise
     */
     bool configured(void);
+
+    /*
+    * Check if the host has suspended the bus
+    *
+    * @returns true if suspended, false otherwise
+    */
+    bool suspended(void) { return device.suspended; }
+
+    /*
+    * Attach a function called when the bus is suspended or resumed.
+    * Warning: Called in ISR context
+    *
+    * @param function Called with true on suspend and false on resume, or NULL
+    */
+    void attachSuspend(void (*function)(bool suspended)) { suspendCallback = function; }
     
     /*
     * Connect a device
+    *
+    * @param blocking If true, wait until the device is configured by the host
     */
-    void connect(void);
+    void connect(bool blocking = true);
     
     /*
     * Disconnect a device
@@ -263,6 +280,8 @@ private:
     
     uint16_t currentInterface;
     uint8_t currentAlternate;
+
+    void (*suspendCallback)(bool suspended);
 };
 
 
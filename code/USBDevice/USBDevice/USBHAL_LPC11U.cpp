@@ -614,9 +614,7 @@ void USBHAL::usbisr(void) {
         if (LPC_USB->DEVCMDSTAT & DSUS_C) {
             // Suspend status changed
             LPC_USB->DEVCMDSTAT = devCmdStat | DSUS_C;
-            if((LPC_USB->DEVCMDSTAT & DSUS) != 0) {
-                suspendStateChanged(1);
-            }
+            suspendStateChanged((LPC_USB->DEVCMDSTAT & DSUS) != 0);
         }
 
         if (LPC_USB->DEVCMDSTAT & DRES_C) {
@@ -573,16 +573,12 @@ void USBHAL::usbisr(void) {
 
         if (devStat & SIE_DS_SUS_CH) {
             // Suspend status changed
-            if((devStat & SIE_DS_SUS) != 0) {
-                suspendStateChanged(0);
-            }
+            suspendStateChanged((devStat & SIE_DS_SUS) != 0);
         }
 
         if (devStat & SIE_DS_RST) {
             // Bus reset
-            if((devStat & SIE_DS_SUS) == 0) {
-                suspendStateChanged(1);
-            }
+            suspendStateChanged(0);
             busReset();
         }
     }
@@ -17,6 +17,7 @@
 */
 
 #include "stdint.h"
+#include "string.h"
 #include "USBHAL.h"
 #include "USBHID.h"
 
@@ -25,6 +26,7 @@ USBHID::USBHID(uint8_t output_report_length, uint8_t input_report_length, uint16
 {
     output_length = output_report_length;
     input_length = input_report_length;
+    inFlight = false;
     if(connect) {
         USBDevice::connect();
     }
@@ -42,6 +44,31 @@ bool USBHID::sendNB(HID_REPORT *report)
 }
 
 
+bool USBHID::sendAsync(HID_REPORT *report)
+{
+    if (inFlight || !configured() || report->length > MAX_HID_REPORT_SIZE)
+    {
+        return false;
+    }
+
+    // Set before the write, the completion interrupt may come right away
+    inFlight = true;
+    if (endpointWrite(EPINT_IN, report->data, report->length) != EP_PENDING)
+    {
+        inFlight = false;
+        return false;
+    }
+    return true;
+}
+
+bool USBHID::EP1_IN_callback()
+{
+    inFlight = false;
+    // Leave the completion flagged, blocking writes poll for it
+    return false;
+}
+
+
 bool USBHID::read(HID_REPORT *report)
 {
     uint32_t bytesRead = 0;
@@ -135,15 +162,44 @@ bool USBHID::USBCallback_request() {
         switch (transfer->setup.bRequest)
         {
              case SET_REPORT:
-                // First byte will be used for report ID
+                // First byte will be used for report ID. The data comes in a
+                // single EP0 packet and is copied when the stage completes.
+                if (transfer->setup.wLength > MAX_PACKET_SIZE_EP0)
+                {
+                    break;
+                }
                 outputReport.data[0] = transfer->setup.wValue & 0xff;
-                outputReport.length = transfer->setup.wLength + 1;
+                outputType = transfer->setup.wValue >> 8;
 
-                transfer->remaining = sizeof(outputReport.data) - 1;
+                transfer->remaining = transfer->setup.wLength;
                 transfer->ptr = &outputReport.data[1];
                 transfer->direction = HOST_TO_DEVICE;
                 transfer->notify = true;
                 success = true;
+                break;
+            case GET_REPORT:
+                requestedReport.data[0] = transfer->setup.wValue & 0xff;
+                requestedReport.length = 1;
+                if (HID_callbackGetReport(transfer->setup.wValue >> 8, &requestedReport))
+                {
+                    // Without report IDs the ID byte is not sent
+                    uint8_t *data = requestedReport.data;
+                    uint32_t length = requestedReport.length;
+                    if (data[0] == 0)
+                    {
+                        data++;
+                        length--;
+                    }
+                    if (length > transfer->setup.wLength)
+                    {
+                        length = transfer->setup.wLength;
+                    }
+                    transfer->remaining = length;
+                    transfer->ptr = data;
+                    transfer->direction = DEVICE_TO_HOST;
+                    success = true;
+                }
+                break;
             default:
                 break;
         }
@@ -153,6 +209,24 @@ bool USBHID::USBCallback_request() {
 }
 
 
+// Called in ISR context
+void USBHID::USBCallback_requestCompleted(uint8_t *buf, uint32_t length) {
+    // With report IDs the data starts with the ID, already in data[0]
+    if (outputReport.data[0] != 0 && length > 0)
+    {
+        buf++;
+        length--;
+    }
+    if (length > sizeof(outputReport.data) - 1)
+    {
+        length = sizeof(outputReport.data) - 1;
+    }
+    memcpy(&outputReport.data[1], buf, length);
+    outputReport.length = length + 1;
+    HID_callbackSetReport(outputType, &outputReport);
+}
+
+
 #define DEFAULT_CONFIGURATION (1)
 
 
@@ -164,7 +238,8 @@ bool USBHID::USBCallback_setConfiguration(uint8_t configuration) {
         return false;
     }
 
-    // Configure endpoints > 0
+    // Configure endpoints > 0, anything queued before is gone
+    inFlight = false;
     addEndpoint(EPINT_IN, MAX_PACKET_SIZE_EPINT);
     addEndpoint(EPINT_OUT, MAX_PACKET_SIZE_EPINT);
 
@@ -79,6 +79,23 @@ public:
     * @returns true if successful
     */
     bool sendNB(HID_REPORT *report);
+
+    /**
+    * Queue a Report and return without waiting. Unlike sendNB, a report still
+    * waiting for the host is never overwritten: nothing is queued while
+    * sendBusy() is true
+    *
+    * @param report Report which will be sent (a report is defined by all data and the length)
+    * @returns true if the report was queued
+    */
+    bool sendAsync(HID_REPORT *report);
+
+    /**
+    * Check if a report queued by sendAsync is still waiting for the host
+    *
+    * @returns true while the report has not been collected
+    */
+    bool sendBusy() { return inFlight; }
     
     /**
     * Read a report: blocking
@@ -139,9 +156,20 @@ protected:
     * HID Report received by SET_REPORT request. Warning: Called in ISR context
     * First byte of data will be the report ID
     *
-    * @param report Data and length received
+    * @param type HID_REPORT_INPUT, HID_REPORT_OUTPUT or HID_REPORT_FEATURE
+    * @param report Data and length received, the length includes the report ID byte
+    */
+    virtual void HID_callbackSetReport(uint8_t type, HID_REPORT *report){};
+
+    /*
+    * HID Report requested by GET_REPORT. Warning: Called in ISR context
+    * First byte of data is set to the report ID, the rest must be filled in
+    *
+    * @param type HID_REPORT_INPUT, HID_REPORT_OUTPUT or HID_REPORT_FEATURE
+    * @param report Report to fill, its length must include the report ID byte
+    * @returns true if the report is supported
     */
-    virtual void HID_callbackSetReport(HID_REPORT *report){};
+    virtual bool HID_callbackGetReport(uint8_t type, HID_REPORT *report){ return false; };
 
 
     /*
@@ -153,6 +181,15 @@ protected:
     */
     virtual bool USBCallback_request();
 
+    /*
+    * Called by USBDevice when the data stage of a SET_REPORT is in.
+    * Warning: Called in ISR context
+    *
+    * @param buf Data received
+    * @param length Number of bytes received
+    */
+    virtual void USBCallback_requestCompleted(uint8_t *buf, uint32_t length);
+
 
     /*
     * Called by USBDevice layer. Set configuration of the device.
@@ -163,8 +200,19 @@ protected:
     */
     virtual bool USBCallback_setConfiguration(uint8_t configuration);
 
+    /*
+    * Called by USBDevice when the host has collected the report on the
+    * interrupt IN endpoint. Warning: Called in ISR context
+    *
+    * @returns true if class handles this request
+    */
+    virtual bool EP1_IN_callback();
+
 private:
+    volatile bool inFlight;
     HID_REPORT outputReport;
+    uint8_t outputType;
+    HID_REPORT requestedReport;
     uint8_t output_length;
     uint8_t input_length;
 };
@@ -40,6 +40,11 @@
 #define SET_REPORT (0x9)
 #define SET_IDLE   (0xa)
 
+/* Report types, high byte of wValue in GET_REPORT and SET_REPORT */
+#define HID_REPORT_INPUT    (1)
+#define HID_REPORT_OUTPUT   (2)
+#define HID_REPORT_FEATURE  (3)
+
 /* HID Class Report Descriptor */
 /* Short items: size is 0, 1, 2 or 3 specifying 0, 1, 2 or 4 (four) bytes */
 /* of data as per HID Class standard */
@@ -18,11 +18,16 @@
 
 #include "stdint.h"
 #include "USBMouse.h"
+#include "us_ticker_api.h"
+
+// Length of a full speed frame
+#define FRAME_US 1000
 
 bool USBMouse::update(int16_t x, int16_t y, uint8_t button, int8_t z, int8_t h) {
     switch (mouse_type) {
         case REL_MOUSE:
-            return mouseSend(x, y, button, z, h);
+            accumulate(x, y, button, z, h);
+            return true;
         case ABS_MOUSE:
             HID_REPORT report;
 
@@ -44,18 +49,197 @@ bool USBMouse::update(int16_t x, int16_t y, uint8_t button, int8_t z, int8_t h)
 bool USBMouse::mouseSend(int16_t x, int16_t y, uint8_t buttons, int8_t z, int8_t h) {
     HID_REPORT report;
 
-    report.data[0] = buttons;// & 0x07;
+    mouseReport(&report, x, y, buttons, z, h);
+    return send(&report);
+}
 
-    report.data[1] = (unsigned int) x & 0x00FF;
-    report.data[2] = (unsigned int) x >> 8;
-    report.data[3] = (unsigned int) y & 0x00FF;
-    report.data[4] = (unsigned int) y >> 8;
-    report.data[5] = -z; // >0 to scroll down, <0 to scroll up
-    report.data[6] = h;
+void USBMouse::mouseReport(HID_REPORT *report, int16_t x, int16_t y, uint8_t buttons, int8_t z, int8_t h) {
+    report->data[0] = REPORT_ID_MOUSE;
+    report->data[1] = buttons;// & 0x07;
 
-    report.length = 7;
+    report->data[2] = (unsigned int) x & 0x00FF;
+    report->data[3] = (unsigned int) x >> 8;
+    report->data[4] = (unsigned int) y & 0x00FF;
+    report->data[5] = (unsigned int) y >> 8;
+    report->data[6] = -z; // >0 to scroll down, <0 to scroll up
+    report->data[7] = h;
 
-    return send(&report);
+    report->length = 8;
+}
+
+void USBMouse::accumulate(int16_t x, int16_t y, uint8_t buttons, int8_t z, int8_t h) {
+    // The start of frame interrupt takes from these
+    __disable_irq();
+    accX += x;
+    accY += y;
+    accZ += z * WHEEL_RESOLUTION;
+    accH += h * WHEEL_RESOLUTION;
+
+    // Every button change gets a frame of its own so a quick click is not
+    // lost. A full queue keeps the latest state in its last slot.
+    uint8_t last = (buttonHead - 1) & (MOUSE_BUTTON_QUEUE - 1);
+    uint8_t queued = buttonHead != buttonTail ? buttonQueue[last] : sentButton;
+    if (buttons != queued) {
+        if (((buttonHead + 1) & (MOUSE_BUTTON_QUEUE - 1)) == buttonTail) {
+            buttonQueue[last] = buttons;
+        } else {
+            buttonQueue[buttonHead] = buttons;
+            buttonHead = (buttonHead + 1) & (MOUSE_BUTTON_QUEUE - 1);
+        }
+    }
+    __enable_irq();
+}
+
+static int32_t clamp(int32_t v, int32_t limit) {
+    if (v > limit) {
+        return limit;
+    }
+    if (v < -limit) {
+        return -limit;
+    }
+    return v;
+}
+
+void USBMouse::SOF(int frameNumber) {
+    if (mouse_type != REL_MOUSE) {
+        return;
+    }
+    sofTime = us_ticker_read();
+    frames++;
+
+    if (frame != NULL) {
+        // A frame without a flush() is sent here so nothing is held back
+        bool missed = !flushed;
+        flushed = false;
+        frame(sofTime);
+        if (!missed) {
+            return;
+        }
+    }
+    sendCollected();
+}
+
+bool USBMouse::flush(uint32_t read_us, bool read) {
+    __disable_irq();
+    flushed = true;
+    bool sent = sendCollected();
+    if (sent && read) {
+        readTime = read_us;
+        readPending = true;
+    }
+    __enable_irq();
+    return sent;
+}
+
+bool USBMouse::EP1_IN_callback() {
+    uint32_t now = us_ticker_read();
+    uint32_t offset = now - sofTime;
+
+    // The host took the report, which is as close to its poll as we get
+    if (offset < FRAME_US) {
+        pollOffset = (pollOffset * 7 + offset) >> 3;
+    }
+    if (readPending) {
+        readToPoll = now - readTime;
+        readPending = false;
+    }
+    bool result = USBHID::EP1_IN_callback();
+
+    // The start of frame goes first when both are pending in one interrupt,
+    // it found the endpoint busy. Send its report now, not a frame late
+    if (skipped) {
+        sendCollected();
+    }
+    return result;
+}
+
+bool USBMouse::sendCollected() {
+    skipped = sendBusy();
+    if (skipped || !configured()) {
+        return false;
+    }
+
+    uint8_t buttons = sentButton;
+    bool changed = buttonHead != buttonTail;
+    if (changed) {
+        buttons = buttonQueue[buttonTail];
+    }
+
+    // Wheels the host left at detent resolution only get whole detents,
+    // the fraction stays collected
+    int32_t zUnit = (resolution & RESOLUTION_VERTICAL) ? 1 : WHEEL_RESOLUTION;
+    int32_t hUnit = (resolution & RESOLUTION_HORIZONTAL) ? 1 : WHEEL_RESOLUTION;
+
+    int16_t x = clamp(accX, 0x7fff);
+    int16_t y = clamp(accY, 0x7fff);
+    int8_t z = clamp(accZ / zUnit, 0x7f);
+    int8_t h = clamp(accH / hUnit, 0x7f);
+
+    if (!changed && x == 0 && y == 0 && z == 0 && h == 0) {
+        return false;
+    }
+
+    HID_REPORT report;
+    mouseReport(&report, x, y, buttons, z, h);
+    if (!sendAsync(&report)) {
+        return false;
+    }
+
+    // Only what went out, the rest waits for the next frame
+    accX -= x;
+    accY -= y;
+    accZ -= z * zUnit;
+    accH -= h * hUnit;
+    if (changed) {
+        sentButton = buttons;
+        buttonTail = (buttonTail + 1) & (MOUSE_BUTTON_QUEUE - 1);
+    }
+    reports++;
+    return true;
+}
+
+bool USBMouse::HID_callbackGetReport(uint8_t type, HID_REPORT *report) {
+    if (mouse_type != REL_MOUSE || type != HID_REPORT_FEATURE) {
+        return false;
+    }
+
+    switch (report->data[0]) {
+        case REPORT_ID_MOUSE:
+            report->data[1] = resolution;
+            report->length = 2;
+            return true;
+        case REPORT_ID_TELEMETRY:
+            if (telemetry == NULL) {
+                return false;
+            }
+            telemetry(report);
+            return true;
+        default:
+            return false;
+    }
+}
+
+void USBMouse::HID_callbackSetReport(uint8_t type, HID_REPORT *report) {
+    if (mouse_type != REL_MOUSE || type != HID_REPORT_FEATURE) {
+        return;
+    }
+    if (report->data[0] == REPORT_ID_MOUSE && report->length >= 2) {
+        resolution = report->data[1] & (RESOLUTION_VERTICAL | RESOLUTION_HORIZONTAL);
+    }
+}
+
+bool USBMouse::USBCallback_setConfiguration(uint8_t configuration) {
+    // A host that wants high resolution sets it again after configuring us
+    resolution = 0;
+    return USBHID::USBCallback_setConfiguration(configuration);
+}
+
+bool USBMouse::scrollFine(int32_t z, int32_t h) {
+    __disable_irq();
+    accZ += z;
+    accH += h;
+    __enable_irq();
+    return true;
 }
 
 bool USBMouse::move(int16_t x, int16_t y) {
@@ -83,13 +267,13 @@ bool USBMouse::click(uint8_t button) {
 
 bool USBMouse::press(uint8_t button_) {
     printf("btn_press\n\r");
-    button = button_ & 0x07;
+    button = (button | button_) & 0x1f;
     return update(0, 0, button, 0, 0);
 }
 
 bool USBMouse::release(uint8_t button_) {
     printf("btn_release\n\r");
-    button = (button & (~button_)) & 0x07;
+    button = (button & (~button_)) & 0x1f;
     return update(0, 0, button, 0, 0);
 }
 
@@ -100,7 +284,7 @@ uint8_t * USBMouse::reportDesc() {
 //
 // Wheel Mouse - simplified version - 5 button, vertical and horizontal wheel
 //
-// Input report - 5 bytes
+// Input report (ID 2) - 7 bytes
 //
 //     Byte | D7      D6      D5      D4      D3      D2      D1      D0
 //    ------+---------------------------------------------------------------------
@@ -112,13 +296,15 @@ uint8_t * USBMouse::reportDesc() {
 //      5   |                       Vertical Wheel
 //      6   |                    Horizontal (Tilt) Wheel
 //
-// Feature report - 1 byte
+// Feature report (ID 2) - 1 byte
 //
 //     Byte | D7      D6      D5      D4   |  D3      D2  |   D1      D0
 //    ------+------------------------------+--------------+----------------
 //      0   |  0       0       0       0   |  Horizontal  |    Vertical
 //                                             (Resolution multiplier)
 //
+// Feature report (ID 3) - 63 bytes, vendor defined sensor telemetry
+//
 // Reference
 //    Wheel.docx in "Enhanced Wheel Support in Windows Vista" on MS WHDC
 //    http://www.microsoft.com/whdc/device/input/wheel.mspx
@@ -127,6 +313,7 @@ uint8_t * USBMouse::reportDesc() {
             0x05, 0x01,        // USAGE_PAGE (Generic Desktop)
             0x09, 0x02,        // USAGE (Mouse)
             0xa1, 0x01,        // COLLECTION (Application)
+            0x85, REPORT_ID_MOUSE, //   REPORT_ID (2)
             0x09, 0x02,        //   USAGE (Mouse)
             0xa1, 0x02,        //   COLLECTION (Logical)
             0x09, 0x01,        //     USAGE (Pointer)
@@ -193,7 +380,19 @@ uint8_t * USBMouse::reportDesc() {
             0xc0,              //       END_COLLECTION
             0xc0,              //     END_COLLECTION
             0xc0,              //   END_COLLECTION
-           0xc0               // END_COLLECTION
+           0xc0,              // END_COLLECTION
+                               // ------------------------------  Telemetry
+            0x06, 0x00, 0xff,  // USAGE_PAGE (Vendor Defined Page 1)
+            0x09, 0x01,        // USAGE (Vendor Usage 1)
+            0xa1, 0x01,        // COLLECTION (Application)
+            0x85, REPORT_ID_TELEMETRY, //   REPORT_ID (3)
+            0x09, 0x02,        //   USAGE (Vendor Usage 2)
+            0x15, 0x00,        //   LOGICAL_MINIMUM (0)
+            0x26, 0xff, 0x00,  //   LOGICAL_MAXIMUM (255)
+            0x75, 0x08,        //   REPORT_SIZE (8)
+            0x95, TELEMETRY_REPORT_LENGTH - 1, //   REPORT_COUNT (63)
+            0xb1, 0x02,        //   FEATURE (Data,Var,Abs)
+            0xc0               // END_COLLECTION
         };
 
         reportLength = sizeof(reportDescriptor);
@@ -22,6 +22,20 @@
 #include "USBHID.h"
 
 #define REPORT_ID_MOUSE   2
+#define REPORT_ID_TELEMETRY 3
+
+/* Length of the vendor telemetry feature report, report ID included */
+#define TELEMETRY_REPORT_LENGTH 64
+
+// Wheel steps per detent once the host enables the resolution multiplier,
+// the physical maximum of the multiplier in the report descriptor.
+#define WHEEL_RESOLUTION 4
+// Resolution multiplier feature bits
+#define RESOLUTION_VERTICAL   0x03
+#define RESOLUTION_HORIZONTAL 0x0c
+
+// Button states waiting for a frame, must be a power of two.
+#define MOUSE_BUTTON_QUEUE 4
 
 /* Common usage */
 
@@ -117,19 +131,38 @@ class USBMouse: public USBHID
         * @param vendor_id Your vendor_id (default: 0x1234)
         * @param product_id Your product_id (default: 0x0001)
         * @param product_release Your preoduct_release (default: 0x0001)
+        * @param connect_blocking Wait for the host to configure the device (default: true)
         *
         */
-        USBMouse(MOUSE_TYPE mouse_type = REL_MOUSE, uint16_t vendor_id = 0x1234, uint16_t product_id = 0x0001, uint16_t product_release = 0x0001): 
+        USBMouse(MOUSE_TYPE mouse_type = REL_MOUSE, uint16_t vendor_id = 0x1234, uint16_t product_id = 0x0001, uint16_t product_release = 0x0001, bool connect_blocking = true): 
             USBHID(0, 0, vendor_id, product_id, product_release, false)
             { 
                 button = 0;
                 this->mouse_type = mouse_type;
-                connect();
+                telemetry = NULL;
+                accX = accY = accZ = accH = 0;
+                sentButton = 0;
+                resolution = 0;
+                buttonHead = buttonTail = 0;
+                reports = 0;
+                frames = 0;
+                frame = NULL;
+                flushed = false;
+                sofTime = readTime = 0;
+                pollOffset = readToPoll = 0;
+                readPending = false;
+                skipped = false;
+                connect(connect_blocking);
             };
         
         /**
         * Write a state of the mouse
         *
+        * A REL_MOUSE never writes here. The motion is added up and the
+        * buttons queued until the next start of frame, which sends a single
+        * report with all of it. Counts that do not fit one report are left
+        * for the next frame, none are dropped.
+        *
         * @param x x-axis position
         * @param y y-axis position
         * @param buttons buttons state (first bit represents MOUSE_LEFT, second bit MOUSE_RIGHT and third bit MOUSE_MIDDLE)
@@ -186,6 +219,75 @@ class USBMouse: public USBHID
         * @returns true if there is no error, false otherwise
         */
         bool scroll(int8_t z, int8_t h);
+
+        /**
+        * Scroll in 1/WHEEL_RESOLUTION detent steps (REL_MOUSE only). The steps are
+        * sent as they come if the host enabled the resolution multiplier of the
+        * wheel, as whole detents otherwise.
+        *
+        * @param z vertical steps (>0 to go down, <0 to go up)
+        * @param h horizontal steps
+        * @returns true if there is no error, false otherwise
+        */
+        bool scrollFine(int32_t z, int32_t h);
+
+        /**
+        * Attach a function to fill the vendor telemetry feature report (REL_MOUSE only).
+        * Warning: it is called in ISR context
+        *
+        * @param function Called with the report to fill, the report ID is already in data[0].
+        *                 It must set the length to TELEMETRY_REPORT_LENGTH, the length in the report descriptor
+        */
+        void attachTelemetry(void (*function)(HID_REPORT *report)) { telemetry = function; }
+
+        /**
+        * Reports sent from the start of frame interrupt so far (REL_MOUSE only)
+        *
+        * @returns number of reports
+        */
+        uint32_t reportCount() { return reports; }
+
+        /**
+        * Start of frames seen so far (REL_MOUSE only)
+        *
+        * @returns number of frames
+        */
+        uint32_t frameCount() { return frames; }
+
+        /**
+        * Take over the report timing (REL_MOUSE only). The start of frame no
+        * longer sends the report, flush() does. A frame that ends without a
+        * flush() still gets its report at the next start of frame.
+        * Warning: the function is called in ISR context
+        *
+        * @param function Called at every start of frame with the us ticker at that
+        *                 time, NULL to send at the start of frame again
+        */
+        void attachFrame(void (*function)(uint32_t sof_us)) { frame = function; }
+
+        /**
+        * Send what was collected so far, if the host has taken the previous report
+        *
+        * @param read_us us ticker of the sensor read the motion comes from
+        * @param read false if the sensor was not read since the last flush(),
+        *             readToPollUs() then keeps its value
+        * @returns true if a report was queued
+        */
+        bool flush(uint32_t read_us, bool read);
+
+        /**
+        * Average time from the start of frame to the host taking the report
+        *
+        * @returns offset in us
+        */
+        uint32_t pollOffsetUs() { return pollOffset; }
+
+        /**
+        * Time from the sensor read of the last flush() to the host taking the report
+        *
+        * @returns distance in us
+        */
+        uint32_t readToPollUs() { return readToPoll; }
         
         /*
         * To define the report descriptor. Warning: this method has to store the length of the report descriptor in reportLength.
@@ -201,11 +303,68 @@ class USBMouse: public USBHID
         * @returns pointer to the configuration descriptor
         */
         virtual uint8_t * configurationDesc();
+
+        /*
+        * Answer GET_REPORT for the wheel resolution multiplier and the telemetry
+        * feature reports. Warning: Called in ISR context
+        */
+        virtual bool HID_callbackGetReport(uint8_t type, HID_REPORT *report);
+
+        /*
+        * Take the wheel resolution multipliers set by the host.
+        * Warning: Called in ISR context
+        */
+        virtual void HID_callbackSetReport(uint8_t type, HID_REPORT *report);
+
+        /*
+        * Back to detent resolution until the host asks again.
+        * Warning: Called in ISR context
+        */
+        virtual bool USBCallback_setConfiguration(uint8_t configuration);
+
+        /*
+        * Send what was collected since the last report, if the previous one
+        * has been taken by the host. Warning: Called in ISR context
+        */
+        virtual void SOF(int frameNumber);
+
+        /*
+        * Time the host taking the report, and send a report that found the
+        * previous one still waiting. Warning: Called in ISR context
+        */
+        virtual bool EP1_IN_callback();
         
     private:
         MOUSE_TYPE mouse_type;
         uint8_t button;
+        void (*telemetry)(HID_REPORT *report);
         bool mouseSend(int16_t x, int16_t y, uint8_t buttons, int8_t z, int8_t h);
+        void mouseReport(HID_REPORT *report, int16_t x, int16_t y, uint8_t buttons, int8_t z, int8_t h);
+        void accumulate(int16_t x, int16_t y, uint8_t buttons, int8_t z, int8_t h);
+
+        // Collected for the next start of frame, the wheels in
+        // 1/WHEEL_RESOLUTION detents
+        volatile int32_t accX;
+        volatile int32_t accY;
+        volatile int32_t accZ;
+        volatile int32_t accH;
+        uint8_t buttonQueue[MOUSE_BUTTON_QUEUE];
+        volatile uint8_t buttonHead;
+        volatile uint8_t buttonTail;
+        uint8_t sentButton;
+        volatile uint32_t reports;
+        volatile uint32_t frames;
+        volatile uint8_t resolution;
+        void (*frame)(uint32_t sof_us);
+        volatile bool flushed;
+        volatile uint32_t sofTime;
+        volatile uint32_t readTime;
+        volatile bool readPending;
+        volatile uint32_t pollOffset;
+        volatile uint32_t readToPoll;
+        // A report was held back because the previous one was not taken yet
+        volatile bool skipped;
+        bool sendCollected();
 };
 
 #endif
@@ -0,0 +1,165 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "eeprom_queue.h"
+
+#define PAGE_BASE(adr) ((adr) & ~(uint32_t)(EEPROM_QUEUE_PAGE_LEN - 1))
+
+EepromQueue::EepromQueue( Ser25LCxxx *eeprom ) : written(0), eeprom(eeprom) {
+    for( int i = 0; i < EEPROM_QUEUE_PAGES; i++ ){
+        pages[i].valid = 0;
+    }
+}
+
+EepromQueue::Page *EepromQueue::find( uint32_t base ){
+    for( int i = 0; i < EEPROM_QUEUE_PAGES; i++ ){
+        if( pages[i].valid && pages[i].base == base ){
+            return &pages[i];
+        }
+    }
+    return NULL;
+}
+
+EepromQueue::Page *EepromQueue::stage( uint32_t base ){
+    Page *p = find( base );
+    if( p ){
+        return p;
+    }
+    for( int i = 0; i < EEPROM_QUEUE_PAGES; i++ ){
+        if( !pages[i].valid ){
+            pages[i].base = base;
+            return &pages[i];
+        }
+    }
+    return NULL;
+}
+
+bool EepromQueue::write( uint32_t adr, uint32_t len, const uint8_t *data ){
+    if( len == 0 ){
+        return true;
+    }
+
+    // All or nothing, count the pages that are not staged yet.
+    int needed = 0;
+    int free = 0;
+    for( uint32_t base = PAGE_BASE( adr ); base < adr + len; base += EEPROM_QUEUE_PAGE_LEN ){
+        if( !find( base ) ){
+            needed++;
+        }
+    }
+    for( int i = 0; i < EEPROM_QUEUE_PAGES; i++ ){
+        if( !pages[i].valid ){
+            free++;
+        }
+    }
+    if( needed > free ){
+        return false;
+    }
+
+    for( uint32_t i = 0; i < len; i++ ){
+        Page *p = stage( PAGE_BASE( adr + i ) );
+        uint32_t ofs = adr + i - p->base;
+        p->data[ofs] = data[i];
+        p->valid |= (uint32_t)1 << ofs;
+    }
+    return true;
+}
+
+bool EepromQueue::read( uint32_t adr, uint32_t len, uint8_t *buf ){
+    while( eeprom->writing() ){
+    }
+    if( !eeprom->read( adr, len, buf ) ){
+        return false;
+    }
+
+    for( int i = 0; i < EEPROM_QUEUE_PAGES; i++ ){
+        Page &p = pages[i];
+        for( uint32_t ofs = 0; p.valid && ofs < EEPROM_QUEUE_PAGE_LEN; ofs++ ){
+            uint32_t a = p.base + ofs;
+            if( (p.valid >> ofs) & 1 && a >= adr && a < adr + len ){
+                buf[a - adr] = p.data[ofs];
+            }
+        }
+    }
+    return true;
+}
+
+bool EepromQueue::poll(){
+    if( !pending() || eeprom->writing() ){
+        return false;
+    }
+
+    // A page the EEPROM refuses stays staged, the others still go out.
+    for( int i = 0; i < EEPROM_QUEUE_PAGES; i++ ){
+        if( pages[i].valid && start( &pages[i] ) ){
+            pages[i].valid = 0;
+            written++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EepromQueue::start( Page *p ){
+    // Only the span from the first to the last staged byte goes out, gaps
+    // in it are read back so they stay as they are.
+    int first = 0;
+    int last = EEPROM_QUEUE_PAGE_LEN - 1;
+    while( !((p->valid >> first) & 1) ){
+        first++;
+    }
+    while( !((p->valid >> last) & 1) ){
+        last--;
+    }
+    int len = last - first + 1;
+
+    uint32_t span = ((uint32_t)2 << last) - ((uint32_t)1 << first);
+    if( (p->valid & span) != span ){
+        uint8_t old[EEPROM_QUEUE_PAGE_LEN];
+        if( !eeprom->read( p->base + first, len, old ) ){
+            return false;
+        }
+        for( int i = first; i <= last; i++ ){
+            if( !((p->valid >> i) & 1) ){
+                p->data[i] = old[i - first];
+            }
+        }
+        // Filled in now, the read is not needed again if the write fails.
+        p->valid |= span;
+    }
+
+    return eeprom->startWrite( p->base + first, len, &p->data[first] );
+}
+
+bool EepromQueue::pending(){
+    for( int i = 0; i < EEPROM_QUEUE_PAGES; i++ ){
+        if( pages[i].valid ){
+            return true;
+        }
+    }
+    return false;
+}
+
+void EepromQueue::flush(){
+    // Stops early if what is left can not be written at all.
+    while( pending() ){
+        if( !poll() && !eeprom->writing() ){
+            break;
+        }
+    }
+    while( eeprom->writing() ){
+    }
+}
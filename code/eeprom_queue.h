@@ -0,0 +1,82 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef EEPROM_QUEUE_H
+#define EEPROM_QUEUE_H
+
+#include <stdint.h>
+#include "Ser25lcxxx.h"
+
+// Pages that can be staged at once, and their size. Any power of two up to
+// 32 and the page size of the part works, a staged page never crosses a
+// real one.
+#define EEPROM_QUEUE_PAGES 4
+#define EEPROM_QUEUE_PAGE_LEN 32
+
+/*
+ * Write-behind for the EEPROM, so saving a setting does not hold up the
+ * tracking loop for the 5ms write cycle of every page.
+ *
+ * write() only copies the data into a staged page, writes to the same page
+ * are merged. poll() is called from the loop when it has nothing else to
+ * do. It checks the WIP bit, and once the EEPROM is free it starts the
+ * write of one page and returns without waiting for it. A page with gaps
+ * has them filled from the EEPROM first, so the bytes in between are
+ * written back unchanged.
+ *
+ * read() serves staged bytes from the queue. The EEPROM can not be read
+ * during a write cycle, so read() waits for the current one to end.
+ */
+class EepromQueue {
+    public:
+        EepromQueue( Ser25LCxxx *eeprom );
+
+        // Stage a write. Returns false, with nothing staged, if it needs
+        // more pages than are free.
+        bool write( uint32_t adr, uint32_t len, const uint8_t *data );
+
+        bool read( uint32_t adr, uint32_t len, uint8_t *buf );
+
+        // Start writing one staged page if the EEPROM is free, never waits.
+        // Returns true if a page was started. A page the EEPROM refuses,
+        // out of its range or across one of its pages, stays staged.
+        bool poll( void );
+
+        bool pending( void );
+
+        // Write everything staged, waiting for each page. Pages the EEPROM
+        // refuses are left staged.
+        void flush( void );
+
+        // Pages written so far.
+        uint32_t written;
+
+    private:
+        struct Page {
+            uint32_t base;
+            uint32_t valid; // A bit for every staged byte, 0 is a free page.
+            uint8_t data[EEPROM_QUEUE_PAGE_LEN];
+        };
+
+        Page *find( uint32_t base );
+        Page *stage( uint32_t base );
+        bool start( Page *p );
+
+        Ser25LCxxx *eeprom;
+        Page pages[EEPROM_QUEUE_PAGES];
+};
+
+#endif
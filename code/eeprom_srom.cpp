@@ -0,0 +1,64 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "eeprom_srom.h"
+
+EepromSrom::EepromSrom( Ser25LCxxx *eeprom, uint16_t offset, uint16_t len )
+    : eeprom(eeprom), offset(offset), len(len), back(0), back_pos(0), back_fill(0){
+}
+
+void EepromSrom::begin(){
+    back = 0;
+    back_pos = 0;
+    back_fill = 0;
+}
+
+uint16_t EepromSrom::back_len(){
+    uint16_t left = len - back_pos;
+    return left < SROM_CHUNK_LEN ? left : SROM_CHUNK_LEN;
+}
+
+void EepromSrom::idle(){
+    uint16_t want = back_len() - back_fill;
+    if( want == 0 ){
+        return;
+    }
+    if( want > SROM_PIECE_LEN ){
+        want = SROM_PIECE_LEN;
+    }
+    eeprom->read( offset + back_pos + back_fill, want, &buf[back][back_fill] );
+    back_fill += want;
+}
+
+uint16_t EepromSrom::next( const uint8_t*& chunk ){
+    uint16_t chunk_len = back_len();
+    if( chunk_len == 0 ){
+        return 0;
+    }
+
+    // Only the first chunk should ever have to be finished here.
+    while( back_fill < chunk_len ){
+        idle();
+    }
+
+    // Hand out the filled buffer and start on the other one, which the
+    // sensor is done with.
+    chunk = buf[back];
+    back ^= 1;
+    back_pos += chunk_len;
+    back_fill = 0;
+    return chunk_len;
+}
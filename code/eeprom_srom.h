@@ -0,0 +1,57 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef EEPROM_SROM_H
+#define EEPROM_SROM_H
+
+#include <stdint.h>
+#include "adns9500.hpp"
+#include "Ser25lcxxx.h"
+
+// Chunk size of the EEPROM firmware source, and how much of a chunk is read
+// by each idle() call while the sensor waits between two SROM bytes. A piece
+// is a 7 byte transaction, 7us at the 8MHz EEPROM clock, inside the 15us of
+// tLOAD, and it fills a chunk four times faster than the sensor empties one.
+#define SROM_CHUNK_LEN 16
+#define SROM_PIECE_LEN 4
+
+/*
+ * Feeds the sensor firmware from the EEPROM to the SROM download. Two chunk
+ * buffers are used, one is being written to the sensor while the other is
+ * filled a piece at a time in the tLOAD gaps between SROM bytes.
+ */
+class EepromSrom : public adns9500::SromSource {
+    public:
+        EepromSrom( Ser25LCxxx *eeprom, uint16_t offset, uint16_t len );
+
+        virtual uint16_t length(){ return len; }
+        virtual void begin( void );
+        virtual uint16_t next( const uint8_t*& chunk );
+        virtual void idle( void );
+
+    private:
+        uint16_t back_len( void );
+
+        Ser25LCxxx *eeprom;
+        uint16_t offset;
+        uint16_t len;
+        uint8_t buf[2][SROM_CHUNK_LEN];
+        uint8_t back;       // Buffer being filled.
+        uint16_t back_pos;  // Firmware position the back buffer starts at.
+        uint16_t back_fill; // Bytes of the back buffer already read.
+};
+
+#endif
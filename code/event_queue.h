@@ -0,0 +1,82 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdint.h>
+#include "mbed.h"
+
+/*
+ * Single producer, single consumer ring for handing events from an
+ * interrupt to the main loop without masking interrupts. The producer only
+ * moves head and the consumer only moves tail, each index is written by one
+ * side alone so no lock is needed. A barrier keeps the slot access ahead of
+ * the index update.
+ *
+ * Several interrupts may push only if none can preempt another while it
+ * does, or with interrupts masked around push().
+ *
+ * N has to be a power of two, the indexes wrap with a mask instead of a
+ * modulo, the M0 has no divider. One slot is kept free to tell full from
+ * empty.
+ */
+template <typename T, uint8_t N>
+class EventQueue {
+    public:
+        EventQueue() : dropped(0), head(0), tail(0) {
+            // Fails to compile if N is not a power of two.
+            (void)sizeof(char[(N & (N - 1)) == 0 ? 1 : -1]);
+        }
+
+        // Producer side. Returns false and counts the event if the queue is full.
+        bool push( const T &event ){
+            uint8_t next = (head + 1) & (N - 1);
+            if( next == tail ){
+                dropped++;
+                return false;
+            }
+            slots[head] = event;
+            __DMB();
+            head = next;
+            return true;
+        }
+
+        // Consumer side. Returns false if there is nothing queued.
+        bool pop( T &event ){
+            if( tail == head ){
+                return false;
+            }
+            event = slots[tail];
+            __DMB();
+            tail = (tail + 1) & (N - 1);
+            return true;
+        }
+
+        bool empty( void ){
+            return tail == head;
+        }
+
+        // Events lost to a full queue.
+        uint32_t dropped;
+
+    private:
+        T slots[N];
+        volatile uint8_t head;
+        volatile uint8_t tail;
+};
+
+#endif
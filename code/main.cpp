@@ -19,6 +19,7 @@
 
 int main(void)
 {
+    boot_timer.start();
     
     printf("And away we go.\n\r");
     activity = 1;
@@ -32,25 +33,35 @@ int main(void)
     #endif
     
     eeprom_spi.format(8,3);
-    eeprom_spi.frequency(1000000);
+    // The sensor firmware is read from the EEPROM in the tLOAD gaps of the
+    // SROM download, a whole read has to fit in the 15us between two bytes.
+    eeprom_spi.frequency(8000000);
     
     #ifdef MBED
-    //eeprom = new Ser25LCxxx( &eeprom_spi, p15, 0x10000, 0x20 ); 
+    eeprom = new Ser25LCxxx( &eeprom_spi, p15, 0x10000, 0x20 ); 
     #elif
     eeprom = new Ser25LCxxx( &eeprom_spi, P1_27, 0x10000, 0x20 ); 
     #endif
 
-    //retreave default and system settings from the EEPROM and override the default values.
+    /*
+     * The settings come in first, they say where the sensor firmware is.
+     * One read of the whole image, checked in one pass.
+     */
     printf("Loading settings\n\r");
-    //for( int i = 0; i < sizeof(s)/sizeof(uint16_t); i++ ){
-    //    printf("Setting %d: %X\r\n", i, s[i]);
-        //set_setting( eeprom, i, s[i], SETTINGS_BASE ); 
-        //s[i] = get_setting( eeprom, i, SETTINGS_BASE );
-    //    printf("Setting %d: %X\r\n", i, s[i]);
-    //}
-    
-    //eeprom->write( s[ADNS_FW_OFFSET], ADNS9500_FIRMWARE_LEN, adns9500FWArray );
-    
+    uint32_t settings_us = us_ticker_read();
+    settings_valid = load_settings( eeprom );
+    settings_us = us_ticker_read() - settings_us;
+    printf("Settings %s in %d us\n\r", settings_valid ? "loaded" : "not valid, using the defaults", settings_us);
+
+    /*
+     * The sensor firmware download is the longest part of booting. It is
+     * started next and advanced with sromPoll() while the profiles are
+     * compiled and the USB device enumerates.
+     */
+    if( run_mode ){
+        sensor_start( eeprom );
+    }
+
     if( run_mode ){
         printf("Tracking mode\n\r");
         track( eeprom );
@@ -61,11 +72,7 @@ int main(void)
     }
 }
 
-void track( Ser25LCxxx *eeprom ){
-    activity = 0;
-
-    mouse = new USBMouse( REL_MOUSE, s[VID], s[PID], s[RELEASE]) ;
-
+void sensor_start( Ser25LCxxx *eeprom ){
     /* 
      * mosi == p5 / P0_9 -- 6
      * miso == p6 / P0_8 -- 4
@@ -78,64 +85,75 @@ void track( Ser25LCxxx *eeprom ){
 
     #ifdef MBED
     printf("Creating sensor object for mbed\n\r");
-    sensor = new adns9500::ADNS9500(p5, p6, p7, p8, adns9500::MAX_SPI_FREQUENCY);
+    sensor = new adns9500::ADNS9500(p5, p6, p7, p8, adns9500::MAX_SPI_FREQUENCY, p14);
     #elif
     printf("Creating sensor object raw chip\n\r");
-    sensor = new adns9500::ADNS9500(P0_9, P0_8, P0_10, P1_16, adns9500::MAX_SPI_FREQUENCY); 
+    sensor = new adns9500::ADNS9500(P0_9, P0_8, P0_10, P1_16, adns9500::MAX_SPI_FREQUENCY, P0_22); 
+    #endif
+
+    // The falling edge of the motion pin only flags that the sensor has data.
+    // The SPI read itself is done from the main loop.
+    sensor->attach(&motionCallback);
+
+    sensor->reset();
+
+    activity = 1;
+
+    #ifdef ADNS9500_FW_IN_FLASH
+    printf("Loading sensor firmware from flash\r\n");
+    srom = new adns9500::FlashSromSource( adns9500FWArray, ADNS9500_FIRMWARE_LEN );
+    #else
+    uint16_t fw_len = s[ADNS_FW_LEN];
+    if( fw_len == 0xffff ){
+        // Never set, assume the stock SROM image.
+        fw_len = ADNS9500_FIRMWARE_LEN;
+    }
+    printf("Loading sensor firmware from EEPROM [%X] [%X]\r\n", s[ADNS_FW_OFFSET], fw_len);
+    srom = new EepromSrom( eeprom, s[ADNS_FW_OFFSET], fw_len );
     #endif
+    sensor->sromStart( srom, &srom_progress );
+}
+
+void track( Ser25LCxxx *eeprom ){
+    activity = 0;
+
+    // Don't block on enumeration, the sensor firmware is still going in.
+    mouse = new USBMouse( REL_MOUSE, s[VID], s[PID], s[RELEASE], false ) ;
+    mouse->attachTelemetry( &telemetry_report );
+    mouse->attachSuspend( &usb_suspend );
     
-    static fn press_funcs[] = {
-        btn_l_press,
-        btn_m_press,
-        btn_r_press,
-        btn_f_press,
-        btn_b_press,
-        btn_z_press,
-        btn_hr_press};
-        
-    static fn release_funcs[] = {
-        btn_l_release,
-        btn_m_release,
-        btn_r_release,
-        btn_f_release,
-        btn_b_release,
-        btn_z_release,
-        btn_hr_release};
-        
     printf("Inisializing buttons\n\r");
 
-// Mouse buttons
+// Mouse buttons, what they do is looked up in the profile when the edge is
+// handled.
 
-    //motion_in.mode(PullDown);
-    //motion_in.fall(motion_get);
-     
     btn_a.mode(PullNone);
-    btn_a.fall(press_funcs[s[BTN_A]]);
-    btn_a.rise(release_funcs[s[BTN_A]]);
+    btn_a.fall(&btn_a_press);
+    btn_a.rise(&btn_a_release);
     
     btn_b.mode(PullNone);
-    btn_b.fall(press_funcs[s[BTN_B]]);
-    btn_b.rise(release_funcs[s[BTN_B]]);
+    btn_b.fall(&btn_b_press);
+    btn_b.rise(&btn_b_release);
 
     btn_c.mode(PullNone);
-    btn_c.fall(press_funcs[s[BTN_C]]);
-    btn_c.rise(release_funcs[s[BTN_C]]);
+    btn_c.fall(&btn_c_press);
+    btn_c.rise(&btn_c_release);
     
     btn_d.mode(PullDown);
-    btn_d.fall(press_funcs[s[BTN_D]]);
-    btn_d.rise(release_funcs[s[BTN_D]]);
+    btn_d.fall(&btn_d_press);
+    btn_d.rise(&btn_d_release);
     
     btn_e.mode(PullNone);
-    btn_e.fall(press_funcs[s[BTN_E]]);
-    btn_e.rise(release_funcs[s[BTN_E]]);
+    btn_e.fall(&btn_e_press);
+    btn_e.rise(&btn_e_release);
     
     btn_f.mode(PullNone);
-    btn_f.fall(press_funcs[s[BTN_F]]);
-    btn_f.rise(release_funcs[s[BTN_F]]);
+    btn_f.fall(&btn_f_press);
+    btn_f.rise(&btn_f_release);
 
     btn_g.mode(PullNone);
-    btn_g.fall(press_funcs[s[BTN_G]]);
-    btn_g.rise(release_funcs[s[BTN_G]]);
+    btn_g.fall(&btn_g_press);
+    btn_g.rise(&btn_g_release);
 
 // Profile buttons
     prfl_a.mode(PullUp);
@@ -163,20 +181,23 @@ void track( Ser25LCxxx *eeprom ){
     debug.rise(&debug_out);
     
     int16_t dx, dy;
-    float mx, my;
+    adns9500::MotionBurst burst;
+    adns9500::MotionBurstStats stats;
+    int telemetry_counter = 0;
+    Timer idle_timer;
+    uint32_t read_time = us_ticker_read();
+    bool read_since_flush = false;
+    uint32_t read_period;
 
 
-    sensor->reset();
-
-    uint8_t *adns_fw;
+    // Every profile is compiled while the firmware download runs.
+    load_profiles();
 
-    //eeprom->write(ADNS_FW_OFFSET, ADNS_FW_LEN, adns9500FWArray);
-    //adns_fw = eeprom->read( ADNS_FW_OFFSET, ADNS_FW_LEN );
-//eeprom->write( s[ADNS_FW_OFFSET], ADNS9500_FIRMWARE_LEN, adns9500FWArray );
+    // Finish the firmware download and the enumeration, whichever is last.
+    while( sensor->sromPoll() || !mouse->configured() ){
+    }
 
-    activity = 1;
-    printf("Loading sensor firmware\r\n");
-    uint16_t crc = sensor->sromDownload( adns9500FWArray, ADNS9500_FIRMWARE_LEN ); //FIXME
+    uint16_t crc = sensor->sromCrc();
 
     if( ADNS6010_FIRMWARE_CRC != crc ){ //ADNS6010_FIRMWARE_CRC
         printf("Firmware CRC does not match [%X] [%X]\n\r", ADNS6010_FIRMWARE_CRC, crc);             
@@ -192,80 +213,170 @@ void track( Ser25LCxxx *eeprom ){
         printf("Firmware CRC matches [%X] [%X]\n\r", ADNS6010_FIRMWARE_CRC, crc);
     }
 
-    // The firmware was set correctly. Freeing the 3K! of ram.
-    //delete adns_fw;
+    // Fill the register shadow once so the resolution changes on the
+    // button presses never have to read the sensor back.
+    sensor->resync();
 
     printf("Enableing lazer\n\r");
     sensor->enableLaser();
-    printf("setting inishal resolution %d %d\n\r", 5670, s[CPI_Y] );
-    sensor->setResolution( s[CPI_X], s[CPI_Y] );
+    // Start on the profile picked last, if one was saved.
+    uint8_t saved[2];
+    if( eeprom->readInto( PROFILE_SAVED, saved ) && saved[0] == (uint8_t)~saved[1] ){
+        s[PROFILE_CURRENT] = saved[0];
+    }
+    eeprom_queue = new EepromQueue( eeprom );
+
+    printf("setting inishal profile %d\n\r", s[PROFILE_CURRENT] );
+    use_profile( s[PROFILE_CURRENT] );
+    profile_load = false;
+
+    power = new PowerManager( sensor );
+    idle_timer.start();
+
+    if( s[READ_LEAD_US] ){
+        printf("Reading the sensor %d us before the USB poll\n\r", s[READ_LEAD_US]);
+        mouse->attachFrame( &frame_start );
+    }
 
+    printf("Boot took %d us\n\r", boot_timer.read_us());
     printf("Starting Loop\n\r");
     activity = 1;
     //Timer st;
     //st.start();
-    int scroll_counter = 0;
+    int32_t scroll_v = 0;
+    int32_t scroll_h = 0;
+    uint32_t momentum_frame = 0;
+    uint32_t loop_frame = mouse->frameCount();
     while (true){
         
         //rest_counter++;
+
+        /*
+         * Switch profiles at the start of a USB frame, before anything is
+         * read for the report of the frame, so a report is never part one
+         * profile and part the other. Without frames (suspended) there are
+         * no reports to split.
+         */
+        uint32_t frame = mouse->frameCount();
+        if( profile_load && (frame != loop_frame || mouse->suspended()) ){
+            profile_load = false;
+            use_profile( s[PROFILE_CURRENT] );
+            save_profile( s[PROFILE_CURRENT] );
+        }
+        loop_frame = frame;
+
         /*
          * Moved the setResolution calls out of the interupt callbacks as they
          * havequite a few waits in them.
          */
+        InputEvent event;
+        while( input_events.pop( event ) ){
+            button_event( event );
+        }
+
         if( set_res_hr ){
             set_res_hr = false;
-            sensor->setResolution( s[CPI_HR_X], s[CPI_HR_Y] );
+            sensor->setResolutionRegisters( profile->res_hr_x, profile->res_hr_y );
         }
         
         if( set_res_z ){
             set_res_z = false;
-            sensor->setResolution( s[CPI_Z], s[CPI_H] );
+            sensor->setResolutionRegisters( profile->res_z, profile->res_h );
         }
         
         if( set_res_default ){
             set_res_default = false;
-            sensor->setResolution( s[CPI_X], s[CPI_Y] );
+            sensor->setResolutionRegisters( profile->res_x, profile->res_y );
         }
      
-        if( !motion_in){
+        /*
+         * Last read before the host polls. The motion pin only falls once
+         * for a run of motion, so the pin level says if there is more.
+         */
+        bool flush = false;
+        if( sample_due ){
+            sample_due = false;
+            flush = true;
+            if( sensor->motionPending() ){
+                motion_triggered = true;
+            }
+        }
 
-            motion_triggered = false;
+        if( motion_triggered ){
 
-            sensor->getMotionDelta(dx, dy);
+            motion_triggered = false;
+            power->motion();
+            idle_timer.reset();
+
+            // An edge from here on is for motion after this read.
+            uint32_t edge = motion_edge;
+
+            /*
+             * A single motion burst read costs one tSRAD instead of the five
+             * separate register reads getMotionDelta() does.
+             */
+            if( ++telemetry_counter >= TELEMETRY_INTERVAL ){
+                telemetry_counter = 0;
+                sensor->getMotionBurst(burst, &stats);
+
+                // The host can ask for the report at any time from the USB
+                // interrupt, don't let it see half a sample.
+                __disable_irq();
+                telemetry.sample( burst.squal, stats );
+                __enable_irq();
+            }
+            else{
+                sensor->getMotionBurst(burst);
+            }
+            dx = burst.dx;
+            dy = burst.dy;
+
+            // The acceleration works off the speed, which needs the time
+            // the counts were collected over. Not simply the time since the
+            // last read, that may have been before a pause.
+            uint32_t now = us_ticker_read();
+            read_period = motion.readPeriod( now, read_time, edge );
+            read_time = now;
+            read_since_flush = true;
+
+            /*
+             * The motion pin stays asserted while the sensor still holds
+             * motion data. No new edge will come for it, so drain it on the
+             * next pass.
+             */
+            if( sensor->motionPending() ){
+                motion_triggered = true;
+            }
 
             if( z_axis_active ){
-
-                if(scroll_counter >= s[SCROLL_SKIP]){
-                    scroll_counter = 0;
-                    mouse->scroll( - dy, dx );
-                }
-                scroll_counter++;
+                /*
+                 * SCROLL_SKIP is the ball counts per wheel detent. The counts
+                 * are turned into 1/WHEEL_RESOLUTION detent steps and what is
+                 * left over is kept for the next read, nothing is dropped.
+                 */
+                int32_t per_detent = profile->scroll_skip;
+                scroll_v -= dy * WHEEL_RESOLUTION;
+                scroll_h += dx * WHEEL_RESOLUTION;
+                int32_t v = scroll_v / per_detent;
+                int32_t h = scroll_h / per_detent;
+                scroll_v -= v * per_detent;
+                scroll_h -= h * per_detent;
+                mouse->scrollFine( v, h );
+                momentum.scrolled( v, h );
             }
             else{
+                if( momentum.active() ){
+                    momentum.cancel();
+                }
+
                 /*
                  * If the cpi multiplyer values are not zero they we modify the
-                 * x and y values accordingly.
+                 * x and y values accordingly, then skew the coordinate plane
+                 * if the skew values are set. Fixed point, the reciprocals
+                 * and the skew matrix were worked out when the profile loaded.
                  */
-                if(s[CPI_X_MULITIPLYER] != 0 and s[CPI_Y_MULITIPLYER] != 0){
-                    mx = (float(abs(dx))/float(s[CPI_X_MULITIPLYER]) + 1.0);
-                    my = (float(abs(dy))/float(s[CPI_Y_MULITIPLYER]) + 1.0);
-                    dx = mx * dx;
-                    dy = my * dy;
-                }
+                motion.apply( dx, dy, read_period );
                 
-                /*
-                 * If the coord skew values are not zero than we will skew the
-                 * coordanite place accordingy.
-                 */
-                if(s[COORD_X_SKEW] != 0 and s[COORD_X_SKEW]){                
-                    float rad_x = degree2rad(s[COORD_X_SKEW]);
-                    float rad_y = degree2rad(s[COORD_Y_SKEW]);
-
-                    float new_x = float(dx) * cos(rad_x) - float(dy) * sin(rad_x);
-                    float new_y = float(dy) * cos(rad_y) + float(dx) * sin(rad_y);               
-                    dx = int(new_x);
-                    dy = int(new_y);
-                }  
                 mouse->move(  int(dx), -int(dy) );
             }
         }
@@ -273,21 +384,55 @@ void track( Ser25LCxxx *eeprom ){
         //}
         
 
-        // Load the current profile.
-        // This rights the first 10 16bit values of the s array from the selected profile.
-        //
-        // Base is calculated...
-        //     selected profile * profile length * 2 + profile base
-        //
-        //     (3 * 7 * 2) + 64  (multiplying by two because they are 16bit values.
-        // TODO: should i move this to a function?
-        if( profile_load ){
-        //    for( int i = 0; i < PROFILE_LEN; i++ ){
-        //        //s[i] = get_setting( eeprom, i, (s[PROFILE_CURRENT] * PROFILE_LEN) + PROFILE_BASE );
-        //    }
-        //    sensor->setResolution( s[CPI_X], s[CPI_Y] );
-            profile_load = false;
+        // Without a read since the last flush read_time is an older report's.
+        if( flush ){
+            mouse->flush( read_time, read_since_flush );
+            read_since_flush = false;
+        }
+
+        // The z mode glide moves on with the USB frames.
+        if( momentum.active() && frame != momentum_frame ){
+            int32_t v, h;
+            momentum.frame( frame - momentum_frame, z_axis_active, v, h );
+            if( v || h ){
+                mouse->scrollFine( v, h );
+            }
+        }
+        momentum_frame = frame;
+
+        if( usb_suspend_changed ){
+            usb_suspend_changed = false;
+            power->suspend( mouse->suspended() );
         }
+
+        /*
+         * The rest modes are stepped down from here rather than left to the
+         * sensor so the firmware knows which one it is in. The SOF interrupt
+         * wakes us every ms while the bus is up, plenty to check the timer.
+         */
+        power->idle( idle_timer.read_ms() );
+
+        /*
+         * Saved settings go out a page per pass once the EEPROM is done
+         * with the previous one, the loop never waits for a write cycle.
+         * The SOF keeps waking us to check on it.
+         */
+        eeprom_queue->poll();
+
+        /*
+         * Nothing left to do, sleep until an interrupt (motion, buttons, USB)
+         * hands us more work. Interrupts are masked while checking so an edge
+         * that lands between the check and the WFI still wakes the core, it
+         * is serviced as soon as they are enabled again. A pending profile
+         * change waits for the SOF, which wakes us anyway.
+         */
+        __disable_irq();
+        if( !motion_triggered && !set_res_hr && !set_res_z
+            && !set_res_default && !usb_suspend_changed
+            && input_events.empty() && !sample_due ){
+            __WFI();
+        }
+        __enable_irq();
     }
 }
 
@@ -311,8 +456,6 @@ void program( Ser25LCxxx *eeprom ){
     //Send the report
     //hid->send(&send_rep);
 
-    uint8_t *tmp;
-
     printf("Entering loop\n\r");
     while (1) {
         if( hid->readNB(&recv_rep)) {
@@ -336,21 +479,27 @@ void program( Ser25LCxxx *eeprom ){
                 case INIT:
                     eeprom->clearMem();
                     break;
+                case FRAME_GRAB:
+                    printf("GRABBING FRAMES\n\r");
+                    frame_grab( hid, eeprom );
+                    break;
                 case LOAD_DATA:
                     printf("LOADING DATA\n\r");
                     base = UINT16( recv_rep.data[1], recv_rep.data[2] );
                     len  = recv_rep.data[3];
+                    if( len > LOAD_DATA_MAX ){
+                        len = LOAD_DATA_MAX;
+                    }
                     printf("BASE: %X LEN: %X\n\r", base, len);
                     load_data( eeprom, base, len, &recv_rep.data[4] );
                     wait(0.1);
-                    tmp = get_data( eeprom, base, len );
+                    // Read back straight into the reply.
+                    get_data( eeprom, base, len, send_rep.data );
                     printf("BASE: %X LEN: %X\n\r", base, len);
                     for( uint16_t i=0; i < (len); i++){
-                        printf("%X\n\r", tmp[i]);
-                        send_rep.data[i] = tmp[i]; //FIXME
+                        printf("%X\n\r", send_rep.data[i]);
                     }
                     hid->send(&send_rep);
-                    delete( tmp);
                     break;
                 case GET_DATA:
                     //base = UINT16( recv_rep.data[1], recv_rep.data[2] );
@@ -364,79 +513,195 @@ void program( Ser25LCxxx *eeprom ){
     }
 }
 
-void btn_l_press(){
-    printf("button,left,press\n\r");
-    mouse->press(MOUSE_LEFT);
+/*
+ * Stream sensor frames to the host until it sends any report. The pixels are
+ * read a slice at a time straight into the report being filled, the pixel
+ * burst waits while the host collects the previous report, so no frame is
+ * ever held in RAM.
+ */
+void frame_grab( USBHID *hid, Ser25LCxxx *eeprom ){
+    HID_REPORT send_rep;
+    HID_REPORT recv_rep;
+    uint8_t rest[FRAME_GRAB_SLICE];
+    int frame_pos = 0;      // Pixels of the frame already sent.
+    int fill = 0;           // Pixels in the report being filled.
+    uint8_t seq = 0;
+    uint8_t fps = 0;
+    int fps_frames = 0;
+    Timer fps_timer;
+
+    if( !sensor ){
+        sensor_start( eeprom );
+        while( sensor->sromPoll() ){
+        }
+        printf("Firmware CRC [%X]\n\r", sensor->sromCrc());
+        sensor->enableLaser();
+    }
+
+    send_rep.length = FRAME_GRAB_HEADER + FRAME_GRAB_PAYLOAD;
+    sensor->captureStart();
+    fps_timer.start();
+
+    while( !hid->readNB(&recv_rep) ){
+
+        if( fill < FRAME_GRAB_PAYLOAD ){
+            fill += sensor->captureRead( &send_rep.data[FRAME_GRAB_HEADER + fill], FRAME_GRAB_SLICE );
+        }
+
+        if( fill == FRAME_GRAB_PAYLOAD && !hid->sendBusy() ){
+            send_rep.data[0] = FRAME_GRAB;
+            send_rep.data[1] = seq;
+            send_rep.data[2] = frame_pos / FRAME_GRAB_PAYLOAD;
+            send_rep.data[3] = fps;
+            if( hid->sendAsync(&send_rep) ){
+                fill = 0;
+                frame_pos += FRAME_GRAB_PAYLOAD;
+            }
+        }
+
+        // The whole frame is out, the sensor takes the next one.
+        if( frame_pos == adns9500::NUMBER_OF_PIXELS_PER_FRAME ){
+            frame_pos = 0;
+            seq++;
+            sensor->captureStart();
+
+            fps_frames++;
+            if( fps_timer.read_ms() >= 1000 ){
+                fps = fps_frames * 1000 / fps_timer.read_ms();
+                fps_frames = 0;
+                fps_timer.reset();
+            }
+        }
+    }
 
+    // Finish the burst so the sensor is left with ncs high.
+    while( sensor->capturing() ){
+        sensor->captureRead( rest, FRAME_GRAB_SLICE );
+    }
+    printf("Frame grab stopped at %d fps\n\r", fps);
 }
-void btn_l_release(){
-    printf("button,left,release\n\r");
-    mouse->release(MOUSE_LEFT);
 
+/*
+ * The button interrupts only queue the edge, anything slow (the USB report,
+ * the sensor resolution, printf) is left to the tracking loop.
+ */
+void queue_button( uint8_t type, uint8_t button ){
+    uint32_t start = us_ticker_read();
+    InputEvent event;
+
+    event.time = start;
+    event.type = type;
+    event.button = button;
+
+    // The queue takes a single producer. Every button has an interrupt of
+    // its own on the LPC11U24 and a priority could be raised later, so the
+    // push is made atomic rather than relying on them never nesting.
+    __disable_irq();
+    input_events.push( event );
+    __enable_irq();
+
+    uint32_t took = us_ticker_read() - start;
+    if( took > button_isr_max_us ){
+        button_isr_max_us = took;
+    }
 }
 
-void btn_m_press(){
-    printf("button,middle,press\n\r");
-    mouse->press(MOUSE_MIDDLE);
+void btn_a_press(){
+    queue_button( EVENT_PRESS, BTN_A - BTN_A );
 }
-void btn_m_release(){
-    printf("button,middle,release\n\r");
-    mouse->release(MOUSE_MIDDLE);
+void btn_a_release(){
+    queue_button( EVENT_RELEASE, BTN_A - BTN_A );
 }
 
-void btn_r_press(){
-    printf("button,right,press\n\r");
-    mouse->press(MOUSE_RIGHT);
+void btn_b_press(){
+    queue_button( EVENT_PRESS, BTN_B - BTN_A );
 }
-
-void btn_r_release(){
-    printf("button,right,release\n\r");
-    mouse->release(MOUSE_RIGHT);
+void btn_b_release(){
+    queue_button( EVENT_RELEASE, BTN_B - BTN_A );
 }
 
-void btn_f_press(){
-    printf("button,forword,press\n\r");
-    mouse->press(MOUSE_FORWORD);
+void btn_c_press(){
+    queue_button( EVENT_PRESS, BTN_C - BTN_A );
 }
-void btn_f_release(){
-    printf("button,forword,release\n\r");
-    mouse->release(MOUSE_FORWORD);
+void btn_c_release(){
+    queue_button( EVENT_RELEASE, BTN_C - BTN_A );
 }
 
-void btn_b_press(){
-    printf("button,back,press\n\r");
-    mouse->press(MOUSE_BACK);
+void btn_d_press(){
+    queue_button( EVENT_PRESS, BTN_D - BTN_A );
+}
+void btn_d_release(){
+    queue_button( EVENT_RELEASE, BTN_D - BTN_A );
 }
 
-void btn_b_release(){
-    printf("button,back,release\n\r");
-    mouse->release(MOUSE_BACK);
+void btn_e_press(){
+    queue_button( EVENT_PRESS, BTN_E - BTN_A );
+}
+void btn_e_release(){
+    queue_button( EVENT_RELEASE, BTN_E - BTN_A );
 }
 
-void btn_hr_press(){
-    printf("button,high_res,press\n\r");
-    set_res_hr = true;
-    set_res_default = false;
-    high_rez_active = true;
+void btn_f_press(){
+    queue_button( EVENT_PRESS, BTN_F - BTN_A );
 }
-void btn_hr_release(){
-    printf("button,high_res,release\n\r");
-    set_res_hr = false;
-    set_res_default = true;
-    high_rez_active = false;
+void btn_f_release(){
+    queue_button( EVENT_RELEASE, BTN_F - BTN_A );
 }
 
-void btn_z_press(){
-    printf("button,z,press\n\r");
-    set_res_z = true;
-    set_res_default = false;
-    z_axis_active = true;
+void btn_g_press(){
+    queue_button( EVENT_PRESS, BTN_G - BTN_A );
+}
+void btn_g_release(){
+    queue_button( EVENT_RELEASE, BTN_G - BTN_A );
 }
-void btn_z_release(){
-    printf("button,z,release\n\r");
-    set_res_z = false;
-    set_res_default = true;
-    z_axis_active = false;
+
+void button_event( const InputEvent &event ){
+    static const uint8_t mouse_buttons[] = {
+        MOUSE_LEFT, MOUSE_MIDDLE, MOUSE_RIGHT, MOUSE_FORWORD, MOUSE_BACK };
+    static const char *names[] = {
+        "left", "middle", "right", "forword", "back", "z", "high_res" };
+    // What each button was pressed as, a release after a profile change
+    // has to undo the press and not the new mapping.
+    static uint8_t held[BUTTONS];
+    bool press = event.type == EVENT_PRESS;
+
+    // Any press stops a z mode glide.
+    if( press ){
+        momentum.cancel();
+    }
+
+    if( event.button >= BUTTONS ){
+        return;
+    }
+    if( press ){
+        held[event.button] = profile->buttons[event.button];
+    }
+    uint8_t action = held[event.button];
+    if( action > ACTION_HIGH_RES ){
+        return;
+    }
+    printf("button,%s,%s\n\r", names[action], press ? "press" : "release");
+
+    switch( action ){
+        case ACTION_HIGH_RES:
+            set_res_hr = press;
+            set_res_default = !press;
+            high_rez_active = press;
+            break;
+        case ACTION_Z:
+            set_res_z = press;
+            set_res_default = !press;
+            z_axis_active = press;
+            break;
+        default:
+            if( press ){
+                mouse->press( mouse_buttons[action] );
+            }
+            else{
+                mouse->release( mouse_buttons[action] );
+            }
+            break;
+    }
 }
 
 void prfl_a_set(){
@@ -467,60 +732,113 @@ void prfl_e_set(){
 void prfl_stub(){
 }
 
+void motionCallback(){
+    motion_edge = us_ticker_read();
+    motion_triggered = true;
+}
+
+void srom_progress( uint16_t loaded, uint16_t total, int crc ){
+    // Blink the activity led while the firmware goes in.
+    activity = (loaded >> 8) & 0x01;
+}
+
+void telemetry_report( HID_REPORT *report ){
+    report->length = telemetry.report( report->data, TELEMETRY_REPORT_LENGTH );
+}
+
+/*
+ * Schedule the last sensor read of the frame READ_LEAD_US before the host
+ * polls, at the poll offset the mouse has measured. Too close to the start
+ * of frame and it goes in the frame before, for the next poll.
+ */
+void frame_start( uint32_t sof_us ){
+    int32_t delay = (int32_t)mouse->pollOffsetUs() - s[READ_LEAD_US];
+    if( delay < 0 ){
+        delay += 1000;
+    }
+    sample_timeout.attach_us( &sample_start, delay );
+}
+
+void sample_start(){
+    sample_due = true;
+}
+
+void usb_suspend( bool suspended ){
+    // Called from the USB interrupt, the SPI traffic is left to the loop.
+    usb_suspend_changed = true;
+}
+
 void debug_out(){
 printf("motion_triggerd %d\n\r" , motion_triggered);
 printf("z_axis_active %d\n\r", z_axis_active);
 printf("high_rez_active %d\n\r", high_rez_active);
 printf("profile_load %d\n\r", profile_load); // Always inishally load the profile even if it might be the same.
+printf("profile %d\n\r", profile - profiles);
 printf("set_res_hr %d\n\r", set_res_hr);
 printf("set_res_z %d\n\r" , set_res_z);
 printf("set_res_default %d\n\r", set_res_default);
+if( sensor ){
+    printf("sensor shadow saved %d\n\r", sensor->shadowSaved());
+}
+if( power ){
+    printf("power state %d\n\r", power->state);
+}
+if( mouse ){
+    printf("mouse reports %d\n\r", mouse->reportCount());
+}
+if( mouse ){
+    printf("poll offset %d us, read to poll %d us\n\r", mouse->pollOffsetUs(), mouse->readToPollUs());
+}
+printf("button isr max %d us, dropped %d\n\r", button_isr_max_us, input_events.dropped);
+if( eeprom_queue ){
+    printf("eeprom pages written %d, pending %d\n\r", eeprom_queue->written, eeprom_queue->pending());
+}
 }
 
 /*
- * The settings are kept in the first 'N' addresses of the of the EEPROM.
- * They are 16bits long. The default settings are in a uint16_t array. So
- * to set/get a setting you use the array value and multiple it by two.
- * This way I can easily get all setting at the start of the program by
- * simply looping through the array.
+ * Read the settings image into settings_image and, if it checks out, copy
+ * the settings into s[]. Anything wrong and s[] is left alone, the profiles
+ * then also use the defaults.
  */
+bool load_settings( Ser25LCxxx *eeprom ){
+    const uint8_t *h = settings_image;
 
+    if( !eeprom->readInto( SETTINGS_BASE, settings_image ) ){
+        return false;
+    }
 
-int set_setting( Ser25LCxxx *eeprom, uint16_t attrib, uint16_t val, uint16_t base_address ){
-
-    uint8_t hl[2];
-    
-    // TODO: Its working but is it working the way i think its working
-    hl[0] = (int)val;
-    hl[1] = (int)(val >> 8);
-    
-    printf("Set Setting %d: L[%X] H[%X]\n\r", attrib, hl[0], hl[1] );
-
-    if ( eeprom->write( attrib * 2, 0x2, hl )){
-        return true;
+    uint16_t len = UINT16( h[5], h[4] );
+    if( h[0] != SETTINGS_VERSION || h[1] != SETTINGS_LEN || h[2] != PROFILE_LEN
+        || h[3] != PROFILES || len != SETTINGS_IMAGE_LEN - SETTINGS_HEADER_LEN ){
+        printf("Settings image header [%X] [%X] [%X] [%X] [%X] does not match\n\r",
+            h[0], h[1], h[2], h[3], len);
+        return false;
     }
-    return false;
-}
 
-uint16_t get_setting( Ser25LCxxx *eeprom, uint16_t attrib, uint16_t base_address ){
-    
-    uint16_t val;
-    uint8_t *hl;
-    
-    hl = eeprom->read( (attrib * 2) + base_address, 0x2 );
-    printf("Get Setting %d: L[%X] H[%X]\n\r", attrib, hl[0], hl[1] );
-    val = UINT16( hl[1], hl[0] );
-    if( val != 0xFFFF ){
-        return val;
+    uint16_t crc = settings_crc( &settings_image[SETTINGS_HEADER_LEN], len );
+    if( crc != UINT16( h[7], h[6] ) ){
+        printf("Settings image CRC does not match [%X] [%X]\n\r", UINT16( h[7], h[6] ), crc);
+        return false;
     }
 
-    return s[attrib];
+    for( int i = 0; i < SETTINGS_LEN; i++ ){
+        const uint8_t *v = &settings_image[SETTINGS_HEADER_LEN + i * 2];
+        s[i] = UINT16( v[1], v[0] );
+    }
+    return true;
 }
 
-void clear_setting( Ser25LCxxx *eeprom, uint16_t attrib, uint16_t base_address ){
-    uint8_t val[2];
-    val[0] = val[1] = 0xFF;
-    eeprom->write( (attrib * 2) + base_address , 0x2, val );
+// CRC-16/CCITT, polynomial 0x1021 starting from 0xffff.
+uint16_t settings_crc( const uint8_t *data, uint16_t len ){
+    uint16_t crc = 0xffff;
+
+    for( uint16_t i = 0; i < len; i++ ){
+        crc ^= data[i] << 8;
+        for( int bit = 0; bit < 8; bit++ ){
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
 }
 
 
@@ -531,6 +849,111 @@ void load_data( Ser25LCxxx *eeprom, uint16_t base, uint16_t len, const uint8_t*
     eeprom->write( base , len, data );
 }
 
-uint8_t* get_data( Ser25LCxxx *eeprom, uint16_t base, uint16_t len ){
-    return (uint8_t*)eeprom->read( base, len );
+bool get_data( Ser25LCxxx *eeprom, uint16_t base, uint16_t len, uint8_t* data ){
+    return eeprom->read( base, len, data );
+}
+
+/*
+ * Compile every profile out of the settings image, keeping the firmware
+ * download going in between.
+ */
+void load_profiles( void ){
+    for( int i = 0; i < PROFILES; i++ ){
+        compile_profile( i, profiles[i] );
+        sensor->sromPoll();
+    }
+}
+
+void compile_profile( uint8_t num, CompiledProfile &p ){
+    uint16_t v[PROFILE_LEN];
+    const uint8_t *raw = &settings_image[SETTINGS_HEADER_LEN + (SETTINGS_LEN + num * PROFILE_LEN) * 2];
+
+    for( int i = 0; i < PROFILE_LEN; i++ ){
+        v[i] = settings_valid ? UINT16( raw[i * 2 + 1], raw[i * 2] ) : s[i];
+    }
+
+    for( int i = 0; i < BUTTONS; i++ ){
+        p.buttons[i] = v[BTN_A + i];
+    }
+
+    p.res_x = sensor->cpi_to_res( v[CPI_X] );
+    p.res_y = sensor->cpi_to_res( v[CPI_Y] );
+    p.res_hr_x = sensor->cpi_to_res( v[CPI_HR_X] );
+    p.res_hr_y = sensor->cpi_to_res( v[CPI_HR_Y] );
+    p.res_z = sensor->cpi_to_res( v[CPI_Z] );
+    p.res_h = sensor->cpi_to_res( v[CPI_H] );
+    p.scroll_skip = v[SCROLL_SKIP] ? v[SCROLL_SKIP] : 1;
+
+    // The driver would clamp a bad range, keep the defaults instead.
+    if( !v[FPS_MIN] || !v[FPS_MAX] || v[FPS_MIN] > v[FPS_MAX] ){
+        printf("Profile %d frame rate range %d-%d not valid, using %d-%d\n\r",
+            num, v[FPS_MIN], v[FPS_MAX], s[FPS_MIN], s[FPS_MAX]);
+        v[FPS_MIN] = s[FPS_MIN];
+        v[FPS_MAX] = s[FPS_MAX];
+    }
+    p.fps_min = v[FPS_MIN];
+    p.fps_max = v[FPS_MAX];
+    p.shutter_max = v[SHUTTER_MAX];
+    p.period_min = v[FPS_MAX] ? 1000000 / v[FPS_MAX] : 1;
+    p.friction = v[MOMENTUM_FRICTION];
+
+    p.mult_x = v[CPI_X_MULITIPLYER];
+    p.mult_y = v[CPI_Y_MULITIPLYER];
+    p.skew_x = v[COORD_X_SKEW];
+    p.skew_y = v[COORD_Y_SKEW];
+}
+
+/*
+ * Make a compiled profile the current one. The register shadow skips the
+ * sensor registers that do not change. The curves come from the EEPROM
+ * through the queue, which waits out a write cycle and has any staged
+ * bytes. A profile without valid curves on both axes keeps the linear
+ * multiplier.
+ */
+void use_profile( uint8_t num ){
+    uint8_t block[ACCEL_CURVE_BLOCK_LEN];
+
+    if( num >= PROFILES ){
+        num = 0;
+    }
+    profile = &profiles[num];
+
+    motion.setAcceleration( profile->mult_x, profile->mult_y );
+    motion.setSkew( profile->skew_x, profile->skew_y );
+    for( int axis = 0; axis < 2; axis++ ){
+        uint32_t base = ACCEL_CURVE_BASE + num * ACCEL_CURVE_PROFILE_LEN + axis * ACCEL_CURVE_BLOCK_LEN;
+        if( !eeprom_queue->read( base, sizeof(block), block ) ){
+            block[1] = 0;
+        }
+        motion.setCurve( axis, block );
+    }
+
+    if( z_axis_active ){
+        sensor->setResolutionRegisters( profile->res_z, profile->res_h );
+    }
+    else if( high_rez_active ){
+        sensor->setResolutionRegisters( profile->res_hr_x, profile->res_hr_y );
+    }
+    else{
+        sensor->setResolutionRegisters( profile->res_x, profile->res_y );
+    }
+    if( !sensor->setFrameBounds( profile->fps_min, profile->fps_max, profile->shutter_max ) ){
+        printf("Profile %d frame rate range clamped\n\r", num);
+    }
+    motion.setPeriodBounds( profile->period_min, sensor->maxFramePeriodUs() );
+    momentum.setFriction( profile->friction );
+}
+
+/*
+ * Remember the profile for the next boot. Only staged here, the tracking
+ * loop writes it out when the EEPROM is free.
+ */
+void save_profile( uint8_t num ){
+    uint8_t saved[2];
+
+    saved[0] = num;
+    saved[1] = ~num;
+    if( !eeprom_queue->write( PROFILE_SAVED, 2, saved ) ){
+        printf("EEPROM queue full, profile %d not saved\n\r", num);
+    }
 }
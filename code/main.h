@@ -15,6 +15,7 @@
  */
 
 #include "mbed.h"
+#include "us_ticker_api.h"
 #include "USBHID.h"
 #include "USBMouse.h"
 #include "Ser25lcxxx.h"
@@ -22,7 +23,14 @@
 
 #include <stdint.h>
 
+// The sensor firmware is streamed from the EEPROM at ADNS_FW_OFFSET, where
+// loststone_simple.py puts it. Defining this compiles it into flash instead,
+// which costs 3K of flash.
+//#define ADNS9500_FW_IN_FLASH
+
+#ifdef ADNS9500_FW_IN_FLASH
 #define ADNS9500_SROM_91
+#endif
 #define ADNS9500_CRCHI (0xBE)
 #define ADNS9500_CRCLO (0xEF)
 #define ADNS9500_ID (0x56)
@@ -30,16 +38,66 @@
 #define ADNS9500_FIRMWARE_LEN 3070
 
 #include "adns9500.hpp"
+#include "telemetry.h"
+#include "power.h"
+#include "motion_math.h"
+#include "event_queue.h"
+#include "momentum.h"
+#include "eeprom_queue.h"
+#include "eeprom_srom.h"
 
 
 #define UINT16(ub, lb)             (uint16_t)(((ub & 0xff) << 8) | (lb & 0xff))
 #define INT16(ub, lb)              (int16_t)(((ub & 0xff) << 8) | (lb & 0xff))
 
+/*
+ * The settings and the profiles are one image at SETTINGS_BASE, read with a
+ * single EEPROM read at boot:
+ *
+ *     Byte  | Content
+ *    -------+----------------------------------------------------------
+ *      0    | SETTINGS_VERSION
+ *      1    | Number of settings, SETTINGS_LEN
+ *      2    | Settings per profile, PROFILE_LEN
+ *      3    | Number of profiles, PROFILES
+ *      4-5  | Length of the data after the header
+ *      6-7  | CRC-16/CCITT of the data after the header
+ *      8-   | s[] and then each profile, 16 bit little endian values
+ *
+ * An image that does not check out is ignored as a whole and the defaults
+ * compiled into s[] are used for everything.
+ */
 #define SETTINGS_BASE 0x00
-#define PROFILE_BASE 0xff
-#define PROFILE_LEN 0x13
+#define SETTINGS_VERSION 1
+#define SETTINGS_HEADER_LEN 8
+#define SETTINGS_LEN (READ_LEAD_US + 1)
+// A profile covers the settings up to LED_ACTION.
+#define PROFILE_LEN (LED_ACTION + 1)
+#define SETTINGS_IMAGE_LEN (SETTINGS_HEADER_LEN + (SETTINGS_LEN + PROFILES * PROFILE_LEN) * 2)
+
+// The last profile picked with the profile buttons and its complement,
+// outside the settings image so saving it leaves the CRC alone.
+#define PROFILE_SAVED 0x0180
+
+// Acceleration curves, an x and a y block of ACCEL_CURVE_BLOCK_LEN bytes per
+// profile. Below the sensor firmware at ADNS_FW_OFFSET.
+#define ACCEL_CURVE_BASE 0xe000
+#define ACCEL_CURVE_PROFILE_LEN (ACCEL_CURVE_BLOCK_LEN * 2)
+
+// Most data a LOAD_DATA report carries, after the action, base and length.
+#define LOAD_DATA_MAX (MAX_HID_REPORT_SIZE - 4)
+
+// Frame grabber reports: action, frame sequence, packet index and frames per
+// second, followed by FRAME_GRAB_PAYLOAD pixels. 15 reports make up a frame.
+#define FRAME_GRAB_HEADER 4
+#define FRAME_GRAB_PAYLOAD 60
+// Pixels read from the sensor between two checks of the USB endpoint.
+#define FRAME_GRAB_SLICE 30
+
+// Motion bursts between two telemetry samples. Sampled bursts read the full
+// burst, seven bytes more than the ones in between.
+#define TELEMETRY_INTERVAL 16
 
-#define degree2rad(deg)  (deg * (3.141592/180))
 #define MBED
 
 typedef void (*fn)(void);
@@ -50,7 +108,8 @@ enum cli_actions {
     LOAD_DATA = 0x03,
     GET_DATA  = 0x04,
     CLEAR     = 0x05,
-    INIT      = 0x06
+    INIT      = 0x06,
+    FRAME_GRAB = 0x07
 };
 
 enum cli_replies {
@@ -67,6 +126,32 @@ enum buttons {
     BUTTON_Z,
     BUTTON_HIGH_RES,
 };
+// What a button does, BTN_A to BTN_G hold one of these.
+enum btn_actions {
+    ACTION_LEFT = 0x00,
+    ACTION_MIDDLE,
+    ACTION_RIGHT,
+    ACTION_FORWARD,
+    ACTION_BACK,
+    ACTION_Z,
+    ACTION_HIGH_RES,
+};
+
+enum input_event_types {
+    EVENT_PRESS = 0x00,
+    EVENT_RELEASE,
+};
+
+// Pushed by the button interrupts, handled by the tracking loop.
+struct InputEvent {
+    uint32_t time;  // us ticker at the edge
+    uint8_t type;   // input_event_types
+    uint8_t button; // 0 to BUTTONS - 1, BTN_A to BTN_G
+};
+
+// Button edges the loop can fall behind by, must be a power of two.
+#define INPUT_EVENT_QUEUE 16
+
 enum settings {
     CPI_X = 0x00, //explisitly showing we start at zero
     CPI_Y,
@@ -74,7 +159,7 @@ enum settings {
     CPI_Y_MULITIPLYER,
     COORD_X_SKEW,
     COORD_Y_SKEW,
-    SCROLL_SKIP,
+    SCROLL_SKIP, // Ball counts per wheel detent in z mode.
     CPI_MAX, // Not currently used.
     CPI_MIN, // Not currently used.
     CPI_STEP, // Not currently used.
@@ -83,6 +168,11 @@ enum settings {
     CPI_HR_X,
     CPI_HR_Y,
 
+    FPS_MIN,     // Slowest the sensor frame rate may drop to.
+    FPS_MAX,     // Fastest frame rate, above 1958 cuts the motion latency.
+    SHUTTER_MAX, // Longest shutter time, in 47MHz sensor clocks.
+    MOMENTUM_FRICTION, // Z mode flick speed lost per frame in 1/65536, 0 is off.
+
     BTN_A,
     BTN_B,
     BTN_C,
@@ -104,6 +194,38 @@ enum settings {
     ADNS_ID,
     ADNS_FW_LEN,
     ADNS_FW_OFFSET,
+
+    READ_LEAD_US, // Last sensor read this long before the USB poll, 0 is off.
+};
+
+#define PROFILES 5
+#define BUTTONS 7
+
+/*
+ * A profile as the tracking loop uses it, worked out from the profile
+ * settings once at boot. Switching profiles points profile at another one
+ * of these and sets motion up for it. The acceleration curves are the bulk
+ * of that, so only the current profile has them in RAM, read from the
+ * EEPROM on the switch.
+ */
+struct CompiledProfile {
+    uint8_t res_x;      // Resolution register values, default,
+    uint8_t res_y;
+    uint8_t res_hr_x;   // high res
+    uint8_t res_hr_y;
+    uint8_t res_z;      // and z mode.
+    uint8_t res_h;
+    uint16_t scroll_skip;
+    uint16_t fps_min;
+    uint16_t fps_max;
+    uint16_t shutter_max;
+    uint32_t period_min; // Shortest sensor frame period, in us.
+    uint16_t friction;
+    uint16_t mult_x;    // Linear acceleration,
+    uint16_t mult_y;
+    int16_t skew_x;     // and skew.
+    int16_t skew_y;
+    uint8_t buttons[BUTTONS]; // btn_actions of BTN_A to BTN_G
 };
 
 
@@ -112,9 +234,6 @@ enum settings {
 #ifdef MBED
 DigitalIn run_mode(p36);
 
-DigitalIn motion_in(p14);
-//InterruptIn motion_in(p14);
-
 
 DigitalOut activity(p35);
 
@@ -136,8 +255,6 @@ InterruptIn prfl_e(p16);
 #elif
 DigitalIn run_mode(P1_29);
 
-DigitalIn motion_in(P0_22);
-
 DigitalOut activity(P1_28);
 
 InterruptIn btn_a(P0_18);
@@ -158,16 +275,33 @@ InterruptIn prfl_e(P1_24);
 // We are global for the callbacks
 USBMouse *mouse;
 adns9500::ADNS9500 *sensor;
-bool motion_triggered = true;
-bool z_axis_active = false;
-bool high_rez_active = false;
-bool profile_load = true; // Always inishally load the profile even if it might be the same.
-bool set_res_hr = false;
-bool set_res_z = false;
-bool set_res_default = false;
+adns9500::SromSource *srom;
+PowerManager *power;
+EepromQueue *eeprom_queue;
+volatile bool motion_triggered = true; // Drain anything the sensor has before the first edge.
+volatile uint32_t motion_edge = 0; // Ticker at the last fall of the motion pin.
+volatile bool z_axis_active = false;
+volatile bool high_rez_active = false;
+volatile bool profile_load = true; // Always inishally load the profile even if it might be the same.
+volatile bool set_res_hr = false;
+volatile bool set_res_z = false;
+volatile bool set_res_default = false;
+volatile bool usb_suspend_changed = false;
+volatile bool sample_due = false;
+Timeout sample_timeout;
+Telemetry telemetry( TELEMETRY_INTERVAL );
+CompiledProfile profiles[PROFILES];
+CompiledProfile *profile = &profiles[0]; // Only changed by the tracking loop.
+MotionMath motion; // Acceleration, curves and skew of the current profile.
+MomentumScroll momentum;
+EventQueue<InputEvent, INPUT_EVENT_QUEUE> input_events;
+volatile uint32_t button_isr_max_us = 0;
 //uint32_t rest_counter;
+Timer boot_timer;
+uint8_t settings_image[SETTINGS_IMAGE_LEN];
+bool settings_valid = false;
 
-uint16_t s[31] = {
+uint16_t s[SETTINGS_LEN] = {
     5670,    // CPI_X
     5670,    // CPI_Y
     0,       // CPI_X_MULITIPLYER
@@ -182,6 +316,10 @@ uint16_t s[31] = {
     0,       // CPI_H
     360,     // CPI_HR_X
     360,     // CPI_HR_Y
+    1958,    // FPS_MIN
+    11750,   // FPS_MAX
+    20000,   // SHUTTER_MAX
+    200,     // MOMENTUM_FRICTION
     BUTTON_Z,
     BUTTON_MIDDLE,
     BUTTON_RIGHT,
@@ -198,36 +336,41 @@ uint16_t s[31] = {
     0xffff,  // ADNS_CRC    (No default, must be set)
     0xffff,  // ADNS_ID     (No default, must be set)
     0xffff,  // ADNS_FW_LEN (No default, must be set)
-    0xea60   // ADNS_FW_OFFSET
+    0xf000,  // ADNS_FW_OFFSET
+    200,     // READ_LEAD_US
 };
 
 
 
+void sensor_start( Ser25LCxxx *eeprom );
 void track( Ser25LCxxx *eeprom );
 void program( Ser25LCxxx *eeprom );
+void frame_grab( USBHID *hid, Ser25LCxxx *eeprom );
 
 void motionCallback( void );
+void srom_progress( uint16_t loaded, uint16_t total, int crc );
+void telemetry_report( HID_REPORT *report );
+void usb_suspend( bool suspended );
+void frame_start( uint32_t sof_us );
+void sample_start( void );
 
-void btn_hr_press( void );
-void btn_hr_release( void );
-
-void btn_z_press( void );
-void btn_z_release( void );
-
-void btn_l_press(void);
-void btn_l_release( void );
-
-void btn_m_press( void );
-void btn_m_release( void );
-
-void btn_r_press( void );
-void btn_r_release( void );
-
-void btn_f_press( void );
-void btn_f_release( void );
+void queue_button( uint8_t type, uint8_t action );
+void button_event( const InputEvent &event );
 
+void btn_a_press( void );
+void btn_a_release( void );
 void btn_b_press( void );
 void btn_b_release( void );
+void btn_c_press( void );
+void btn_c_release( void );
+void btn_d_press( void );
+void btn_d_release( void );
+void btn_e_press( void );
+void btn_e_release( void );
+void btn_f_press( void );
+void btn_f_release( void );
+void btn_g_press( void );
+void btn_g_release( void );
 
 void prfl_a_set( void );
 void prfl_b_set( void );
@@ -239,10 +382,14 @@ void motion_get(void);
 void prfl_stub( void );
 void debug_out(void);
 
-int set_setting( Ser25LCxxx *eeprom, uint16_t attrib, uint16_t val, uint16_t base_address );
-uint16_t get_setting( Ser25LCxxx *eeprom, uint16_t attrib, uint16_t base_address );
-void clear_setting( Ser25LCxxx *eeprom, uint16_t attrib, uint16_t base_address );
+bool load_settings( Ser25LCxxx *eeprom );
+uint16_t settings_crc( const uint8_t *data, uint16_t len );
 
 void load_data( Ser25LCxxx *eeprom, uint16_t base, uint16_t len, const uint8_t* data );
 
-uint8_t* get_data( Ser25LCxxx *eeprom, uint16_t base, uint16_t len );
+bool get_data( Ser25LCxxx *eeprom, uint16_t base, uint16_t len, uint8_t* data );
+
+void load_profiles( void );
+void compile_profile( uint8_t num, CompiledProfile &p );
+void use_profile( uint8_t num );
+void save_profile( uint8_t num );
@@ -0,0 +1,128 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "momentum.h"
+
+static int32_t magnitude( int32_t v ){
+    return v < 0 ? -v : v;
+}
+
+// Shift rounding towards zero, so scrolling up slows down like down does.
+static int32_t shift( int64_t v, int n ){
+    return v < 0 ? -(int32_t)(-v >> n) : (int32_t)(v >> n);
+}
+
+MomentumScroll::MomentumScroll() : state(IDLE), decay(0) {
+    cancel();
+}
+
+void MomentumScroll::setFriction( uint16_t friction ){
+    decay = friction ? 0x10000UL - friction : 0;
+    if( !decay ){
+        cancel();
+    }
+}
+
+void MomentumScroll::scrolled( int32_t v, int32_t h ){
+    if( !decay ){
+        return;
+    }
+    if( state != TRACKING ){
+        // The ball is driving again, any glide is over.
+        cancel();
+        state = TRACKING;
+    }
+    steps_v += v;
+    steps_h += h;
+}
+
+void MomentumScroll::cancel(){
+    state = IDLE;
+    steps_v = steps_h = 0;
+    speed_v = speed_h = 0;
+    flick_v = flick_h = 0;
+    pos_v = pos_h = 0;
+    quiet = 0;
+}
+
+void MomentumScroll::frame( uint32_t frames, bool held, int32_t &v, int32_t &h ){
+    v = h = 0;
+
+    if( state == TRACKING ){
+        if( steps_v || steps_h ){
+            // Average speed since the last steps, almost always one frame.
+            // A slow drag has quiet frames in between and is no flick.
+            int32_t span = frames + quiet;
+            int32_t sample_v = steps_v * 256;
+            int32_t sample_h = steps_h * 256;
+            if( span > 1 ){
+                sample_v /= span;
+                sample_h /= span;
+            }
+            speed_v += shift( sample_v - speed_v, 2 );
+            speed_h += shift( sample_h - speed_h, 2 );
+            flick_v = speed_v;
+            flick_h = speed_h;
+            steps_v = steps_h = 0;
+            quiet = 0;
+        }
+        else{
+            // Still held, the speed just fades while we wait.
+            speed_v -= shift( speed_v, 2 );
+            speed_h -= shift( speed_h, 2 );
+            if( quiet < MOMENTUM_QUIET_FRAMES ){
+                quiet += frames < MOMENTUM_QUIET_FRAMES ? frames : MOMENTUM_QUIET_FRAMES;
+            }
+        }
+
+        if( !held || quiet >= MOMENTUM_QUIET_FRAMES ){
+            glide();
+        }
+        return;
+    }
+
+    if( state == GLIDING ){
+        for( uint32_t i = 0; i < frames && state == GLIDING; i++ ){
+            v += step( pos_v, speed_v );
+            h += step( pos_h, speed_h );
+            if( magnitude( speed_v ) < MOMENTUM_STOP && magnitude( speed_h ) < MOMENTUM_STOP ){
+                cancel();
+            }
+        }
+    }
+}
+
+// Glide at the speed of the last frame with ball motion, if it was a flick.
+void MomentumScroll::glide(){
+    int32_t v = flick_v;
+    int32_t h = flick_h;
+
+    cancel();
+    if( magnitude( v ) >= MOMENTUM_START || magnitude( h ) >= MOMENTUM_START ){
+        speed_v = v;
+        speed_h = h;
+        state = GLIDING;
+    }
+}
+
+// Move one frame at speed, hand out the whole steps and slow down.
+int32_t MomentumScroll::step( int32_t &pos, int32_t &speed ){
+    pos += speed;
+    int32_t whole = shift( pos, 8 );
+    pos -= whole * 256;
+    speed = shift( (int64_t)speed * decay, 16 );
+    return whole;
+}
@@ -0,0 +1,85 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef MOMENTUM_H
+#define MOMENTUM_H
+
+#include <stdint.h>
+
+// Frames without wheel steps before the ball counts as stopped.
+#define MOMENTUM_QUIET_FRAMES 16
+// Slowest flick that starts a glide and slowest glide that keeps going, in
+// 1/256 wheel steps per frame.
+#define MOMENTUM_START 64
+#define MOMENTUM_STOP 16
+
+/*
+ * Flick to scroll for z mode. While the wheel is driven by the ball the
+ * speed is tracked per USB frame, when the z button is let go or the ball
+ * stops the wheel keeps turning at that speed and slows down by the profile
+ * friction every frame.
+ *
+ * Speeds are in 1/256 wheel steps per frame and the friction is the share
+ * of the speed lost each frame in 1/65536, integer math only. Nothing runs
+ * while active() is false.
+ */
+class MomentumScroll {
+    public:
+        MomentumScroll( void );
+
+        // Speed lost per frame in 1/65536, 0 turns momentum off.
+        void setFriction( uint16_t friction );
+
+        // Wheel steps the ball just produced in z mode.
+        void scrolled( int32_t v, int32_t h );
+
+        // Stop tracking and gliding, on any other input.
+        void cancel( void );
+
+        /*
+         * Once for every USB frame gone by while active(). held is false once
+         * the z button is up. Returns the wheel steps to send in v and h.
+         */
+        void frame( uint32_t frames, bool held, int32_t &v, int32_t &h );
+
+        bool active( void ){
+            return state != IDLE;
+        }
+
+    private:
+        enum states {
+            IDLE,
+            TRACKING,
+            GLIDING
+        };
+
+        void glide( void );
+        int32_t step( int32_t &pos, int32_t &speed );
+
+        states state;
+        uint32_t decay;
+        int32_t steps_v;
+        int32_t steps_h;
+        int32_t speed_v;
+        int32_t speed_h;
+        int32_t flick_v;
+        int32_t flick_h;
+        int32_t pos_v;
+        int32_t pos_h;
+        uint8_t quiet;
+};
+
+#endif
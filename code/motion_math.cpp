@@ -0,0 +1,203 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "motion_math.h"
+#include <math.h>
+
+// Clamps to what still fits an int16_t report once the fraction is gone. Kept
+// symmetric so negating the result can never overflow.
+static q16_t saturate( int64_t v ){
+    if( v > (int64_t)INT16_MAX * Q16_ONE ){
+        return (q16_t)INT16_MAX * Q16_ONE;
+    }
+    if( v < -(int64_t)INT16_MAX * Q16_ONE ){
+        return -(q16_t)INT16_MAX * Q16_ONE;
+    }
+    return (q16_t)v;
+}
+
+static q16_t q16_from_float( float v ){
+    return (q16_t)(v * Q16_ONE + (v < 0 ? -0.5f : 0.5f));
+}
+
+// 2^40 / (mult * ACCEL_REFERENCE_US), at most 2^30 for a multiplier of one.
+static uint32_t recip( uint16_t mult ){
+    uint32_t den = (uint32_t)mult * ACCEL_REFERENCE_US;
+    return (((uint64_t)1 << MOTION_RECIP_SHIFT) + den / 2) / den;
+}
+
+MotionMath::MotionMath()
+    : accel_on(false), recip_x(0), recip_y(0), curve_on(false),
+      period_min(1), period_max(1000000 / 1958), residual_x(0), residual_y(0) {
+    curves[0].knots = curves[1].knots = 0;
+    setMatrix( Q16_ONE, 0, 0, Q16_ONE );
+}
+
+void MotionMath::setAcceleration( uint16_t mult_x, uint16_t mult_y ){
+    accel_on = mult_x != 0 && mult_y != 0;
+    recip_x = accel_on ? recip( mult_x ) : 0;
+    recip_y = accel_on ? recip( mult_y ) : 0;
+}
+
+void MotionMath::setPeriodBounds( uint32_t min_us, uint32_t max_us ){
+    period_min = min_us ? min_us : 1;
+    period_max = max_us > period_min ? max_us : period_min;
+}
+
+bool MotionMath::setCurve( int axis, const uint8_t *block ){
+    AccelCurve &c = curves[axis];
+
+    c.shift = block[0];
+    c.knots = block[1];
+    if( c.shift > ACCEL_CURVE_MAX_SHIFT || c.knots < 2 || c.knots > ACCEL_CURVE_MAX_KNOTS ){
+        c.knots = 0;
+        curve_on = false;
+        return false;
+    }
+    for( int i = 0; i < c.knots; i++ ){
+        c.gain[i] = block[2 + i * 2] | (block[3 + i * 2] << 8);
+    }
+    curve_on = curves[0].knots && curves[1].knots;
+    return true;
+}
+
+void MotionMath::setMatrix( q16_t xx, q16_t xy, q16_t yx, q16_t yy ){
+    m[0][0] = xx;
+    m[0][1] = xy;
+    m[1][0] = yx;
+    m[1][1] = yy;
+    identity = xx == Q16_ONE && xy == 0 && yx == 0 && yy == Q16_ONE;
+}
+
+/*
+ * Same transform the tracking loop used to work out per report:
+ *
+ *     x' = x * cos(skew_x) - y * sin(skew_x)
+ *     y' = y * cos(skew_y) + x * sin(skew_y)
+ *
+ * Only runs when the profile loads, the soft-float trig is fine here.
+ */
+void MotionMath::setSkew( int16_t deg_x, int16_t deg_y ){
+    if( deg_x == 0 && deg_y == 0 ){
+        setMatrix( Q16_ONE, 0, 0, Q16_ONE );
+        return;
+    }
+    float rad_x = deg_x * (3.14159265f / 180);
+    float rad_y = deg_y * (3.14159265f / 180);
+
+    setMatrix( q16_from_float( cosf(rad_x) ), q16_from_float( -sinf(rad_x) ),
+               q16_from_float( sinf(rad_y) ), q16_from_float( cosf(rad_y) ) );
+}
+
+uint32_t MotionMath::readPeriod( uint32_t now, uint32_t prev, uint32_t edge ){
+    // Wrap safe, the ticker rolls over every 71 minutes.
+    uint32_t start = edge - period_max;
+    if( (int32_t)(start - prev) < 0 ){
+        start = prev;
+    }
+    return now - start;
+}
+
+// |d| counts over the read period as counts per second.
+uint32_t MotionMath::speed( int16_t d, uint32_t rate ){
+    uint32_t mag = d < 0 ? -(int32_t)d : d;
+    uint64_t v = ((uint64_t)mag * rate) >> MOTION_RATE_SHIFT;
+    return v > UINT32_MAX ? UINT32_MAX : (uint32_t)v;
+}
+
+/*
+ * d * (speed / (mult * 1000) + 1). The gain is brought to Q16 before it is
+ * applied, speed and reciprocal fit 32 bits each so their product fits 64.
+ */
+q16_t MotionMath::accel( int16_t d, uint32_t speed, uint32_t recip ){
+    uint64_t gain = ((uint64_t)speed * recip) >> (MOTION_RECIP_SHIFT - Q16_SHIFT);
+    if( gain > (uint64_t)INT32_MAX ){
+        gain = INT32_MAX;
+    }
+    return saturate( (int64_t)d * (int64_t)(gain + Q16_ONE) );
+}
+
+/*
+ * Same cost whatever the speed: a shift for the knot, one multiply for the
+ * interpolation and one to apply the gain. The gain difference fits 17 bits
+ * and the fraction ACCEL_CURVE_MAX_SHIFT, so the product fits 32.
+ */
+q16_t MotionMath::curve( int16_t d, uint32_t speed, const AccelCurve &c ){
+    uint32_t knot = speed >> c.shift;
+    int32_t gain;
+
+    if( knot >= (uint32_t)c.knots - 1 ){
+        gain = c.gain[c.knots - 1];
+    }
+    else{
+        int32_t frac = speed & ((1UL << c.shift) - 1);
+        gain = c.gain[knot] + (((int32_t)c.gain[knot + 1] - c.gain[knot]) * frac >> c.shift);
+    }
+    return saturate( (int64_t)d * gain * (1 << (Q16_SHIFT - ACCEL_CURVE_GAIN_SHIFT)) );
+}
+
+void MotionMath::apply( int16_t &dx, int16_t &dy, uint32_t dt_us ){
+    if( !accel_on && !curve_on && identity ){
+        return;
+    }
+
+    // Kept in Q16 from one stage to the next, only the result is truncated.
+    q16_t x, y;
+    if( curve_on || accel_on ){
+        // The one division per report, shared by both axes.
+        if( dt_us < period_min ){
+            dt_us = period_min;
+        }
+        uint32_t rate = (1000000UL << MOTION_RATE_SHIFT) / dt_us;
+        uint32_t speed_x = speed( dx, rate );
+        uint32_t speed_y = speed( dy, rate );
+
+        if( curve_on ){
+            x = curve( dx, speed_x, curves[0] );
+            y = curve( dy, speed_y, curves[1] );
+        }
+        else{
+            x = accel( dx, speed_x, recip_x );
+            y = accel( dy, speed_y, recip_y );
+        }
+    }
+    else{
+        x = q16_from_int( dx );
+        y = q16_from_int( dy );
+    }
+
+    if( !identity ){
+        q16_t tx = saturate( ((int64_t)m[0][0] * x + (int64_t)m[0][1] * y) >> Q16_SHIFT );
+        q16_t ty = saturate( ((int64_t)m[1][0] * x + (int64_t)m[1][1] * y) >> Q16_SHIFT );
+        x = tx;
+        y = ty;
+    }
+
+    dx = carry( x, residual_x );
+    dy = carry( y, residual_y );
+}
+
+/*
+ * Sends the whole counts and keeps the fraction for the next report, so the
+ * counts sent always add up to the scaled counts to within one. Truncating
+ * each report on its own stalled slow movement at high cpi.
+ */
+int16_t MotionMath::carry( q16_t v, q16_t &residual ){
+    v = saturate( (int64_t)v + residual );
+    int32_t whole = q16_to_int( v );
+    residual = v - q16_from_int( whole );
+    return whole;
+}
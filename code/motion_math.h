@@ -0,0 +1,149 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef MOTION_MATH_H
+#define MOTION_MATH_H
+
+#include <stdint.h>
+
+/*
+ * Q16.16 fixed point, the LPC11U24 has neither an FPU nor a divider so the
+ * tracking path sticks to integer multiplies and shifts. Anything needing a
+ * division is worked out once when the profile loads.
+ */
+typedef int32_t q16_t;
+
+#define Q16_SHIFT 16
+#define Q16_ONE   ((q16_t)1 << Q16_SHIFT)
+
+static inline q16_t q16_from_int( int32_t v ){
+    return v * Q16_ONE;
+}
+
+// Truncates towards zero, the same as the float to int conversion did.
+static inline int32_t q16_to_int( q16_t v ){
+    return v < 0 ? -(-v >> Q16_SHIFT) : v >> Q16_SHIFT;
+}
+
+static inline q16_t q16_mul( q16_t a, q16_t b ){
+    return (q16_t)(((int64_t)a * b) >> Q16_SHIFT);
+}
+
+// Fraction bits of the acceleration reciprocals.
+#define MOTION_RECIP_SHIFT 40
+// Fraction bits of the per report counts to counts per second factor.
+#define MOTION_RATE_SHIFT 12
+// The linear multiplier is in counts per this many us, the USB poll interval
+// the sensor used to be read at.
+#define ACCEL_REFERENCE_US 1000
+
+/*
+ * Acceleration curves as they are kept in the EEPROM, one block per axis:
+ *
+ *     Byte  | Content
+ *    -------+----------------------------------------------------------
+ *      0    | Shift, knots are 1 << shift counts per second apart
+ *      1    | Number of knots, 2 to ACCEL_CURVE_MAX_KNOTS
+ *      2-   | Gain at each knot, 16 bit little endian, 8 fraction bits
+ *
+ * Speeds past the last knot get the gain of the last knot. An erased block
+ * fails the checks and leaves the linear acceleration in place.
+ */
+#define ACCEL_CURVE_MAX_KNOTS 64
+#define ACCEL_CURVE_MAX_SHIFT 15
+#define ACCEL_CURVE_GAIN_SHIFT 8
+#define ACCEL_CURVE_BLOCK_LEN (2 + ACCEL_CURVE_MAX_KNOTS * 2)
+
+struct AccelCurve {
+    uint8_t shift;
+    uint8_t knots;
+    uint16_t gain[ACCEL_CURVE_MAX_KNOTS];
+};
+
+/*
+ * Turns raw sensor counts into the counts sent to the host.
+ *
+ * The acceleration is driven by the speed in counts per second, worked out
+ * from the time between two sensor reads. The counts of a single read depend
+ * on how often the loop gets around to the sensor, the speed does not.
+ *
+ * The linear acceleration is speed / (multiplier * 1000) + 1, the multiplier
+ * being in counts per ms as it was when the sensor was read once per USB
+ * frame. The multipliers are turned into reciprocals by setAcceleration() so
+ * apply() only divides once, for the speed. A profile with curves on both
+ * axes uses those instead, a knot lookup and a linear interpolation between
+ * two knots.
+ *
+ * The accelerated counts then go through a 2x2 Q16 matrix, four multiplies
+ * and two adds per report. setSkew() fills it from the coordinate skew
+ * settings, setMatrix() takes any other linear transform, a calibration
+ * combining per axis scale and rotation for example.
+ *
+ * Whatever fraction of a count is left after the transform is carried into
+ * the next report instead of being dropped.
+ */
+class MotionMath {
+    public:
+        MotionMath( void );
+
+        // A zero multiplier on either axis turns the acceleration off.
+        void setAcceleration( uint16_t mult_x, uint16_t mult_y );
+
+        // Parse an EEPROM curve block for axis 0 (x) or 1 (y). Returns false
+        // and turns the curves off if the block is not valid.
+        bool setCurve( int axis, const uint8_t *block );
+
+        // Rows of the matrix, x' = xx * x + xy * y and y' = yx * x + yy * y.
+        void setMatrix( q16_t xx, q16_t xy, q16_t yx, q16_t yy );
+
+        // Skew of each axis in degrees, both zero is the identity.
+        void setSkew( int16_t deg_x, int16_t deg_y );
+
+        // Shortest and longest sensor frame periods. A read never covers
+        // less than a frame.
+        void setPeriodBounds( uint32_t min_us, uint32_t max_us );
+
+        // Time the counts of a read were collected over, from the ticker at
+        // this read (now), the one before it (prev) and the last fall of the
+        // motion pin seen before this read started (edge). After a still
+        // spell the pin falls at the end of the first frame that moved, the
+        // counts go back a frame from there and no further. A read that is
+        // late without a pause covers the whole time since the last one.
+        uint32_t readPeriod( uint32_t now, uint32_t prev, uint32_t edge );
+
+        // dt_us is the time the counts were collected over, see readPeriod().
+        void apply( int16_t &dx, int16_t &dy, uint32_t dt_us );
+
+    private:
+        uint32_t speed( int16_t d, uint32_t rate );
+        q16_t accel( int16_t d, uint32_t speed, uint32_t recip );
+        q16_t curve( int16_t d, uint32_t speed, const AccelCurve &c );
+        int16_t carry( q16_t v, q16_t &residual );
+
+        bool accel_on;
+        uint32_t recip_x;
+        uint32_t recip_y;
+        bool curve_on;
+        AccelCurve curves[2];
+        uint32_t period_min;
+        uint32_t period_max;
+        q16_t m[2][2];
+        bool identity;
+        q16_t residual_x;
+        q16_t residual_y;
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "power.h"
+
+PowerManager::PowerManager( adns9500::ADNS9500 *sensor )
+    : state(RUN), sensor(sensor), suspended(false){
+}
+
+void PowerManager::motion(){
+    if( !suspended ){
+        enter( RUN );
+    }
+}
+
+void PowerManager::idle( uint32_t idle_ms ){
+    if( suspended ){
+        return;
+    }
+
+    // Only ever step down here, waking up is left to motion().
+    if( idle_ms >= POWER_REST3_MS ){
+        if( state < REST3 ){
+            enter( REST3 );
+        }
+    }
+    else if( idle_ms >= POWER_REST2_MS ){
+        if( state < REST2 ){
+            enter( REST2 );
+        }
+    }
+    else if( idle_ms >= POWER_REST1_MS ){
+        if( state < REST1 ){
+            enter( REST1 );
+        }
+    }
+}
+
+void PowerManager::suspend( bool suspended ){
+    this->suspended = suspended;
+    enter( suspended ? REST3 : RUN );
+}
+
+void PowerManager::enter( states next ){
+    if( next == state ){
+        return;
+    }
+    state = next;
+    sensor->setRestMode( (adns9500::RestMode)next );
+}
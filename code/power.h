@@ -0,0 +1,67 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+#include "adns9500.hpp"
+
+// Time without motion before each rest mode is forced, in ms. Close to the
+// sensor's own downshift times.
+#define POWER_REST1_MS 1000
+#define POWER_REST2_MS 10000
+#define POWER_REST3_MS 600000
+
+/*
+ * Steps the sensor down through its rest modes while the ball sits still
+ * and back to run on the first motion. A suspended host puts it straight
+ * into the deepest rest mode, where it stays until the bus resumes, there
+ * is nobody to send the motion to anyway.
+ *
+ * The rest modes still notice motion and pull the motion pin, so waking
+ * up costs a single CONFIGURATION_II write from the tracking loop.
+ */
+class PowerManager {
+    public:
+        enum states {
+            RUN   = adns9500::REST_NONE,
+            REST1 = adns9500::REST_1,
+            REST2 = adns9500::REST_2,
+            REST3 = adns9500::REST_3
+        };
+
+        PowerManager( adns9500::ADNS9500 *sensor );
+
+        // Motion was seen, go back to run.
+        void motion( void );
+
+        // Step down if the ball has been still long enough.
+        void idle( uint32_t idle_ms );
+
+        // The host suspended or resumed the bus.
+        void suspend( bool suspended );
+
+        states state;
+
+    private:
+        void enter( states next );
+
+        adns9500::ADNS9500 *sensor;
+        bool suspended;
+};
+
+#endif
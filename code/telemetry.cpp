@@ -0,0 +1,128 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "telemetry.h"
+
+// Samples the means are taken over before they start to fade.
+#define TELEMETRY_WINDOW 0x8000
+
+#define PUT_UINT16(p, v) do{ (p)[0] = (v) & 0xff; (p)[1] = ((v) >> 8) & 0xff; }while(0)
+
+Telemetry::Telemetry( uint8_t interval ) : interval(interval) {
+    reset();
+}
+
+void Telemetry::reset(){
+    for( int i = 0; i < CHANNELS; i++ ){
+        min[i] = 0xffff;
+        max[i] = 0;
+        sum[i] = 0;
+    }
+    for( int i = 0; i < TELEMETRY_BUCKETS; i++ ){
+        squal_hist[i] = 0;
+        shutter_hist[i] = 0;
+    }
+    count = 0;
+    samples = 0;
+}
+
+void Telemetry::sample( uint8_t squal, const adns9500::MotionBurstStats& stats ){
+
+    if( count >= TELEMETRY_WINDOW ){
+        for( int i = 0; i < CHANNELS; i++ ){
+            sum[i] >>= 1;
+        }
+        count >>= 1;
+    }
+
+    add( SQUAL, squal );
+    add( PIXEL_SUM, stats.pixelSum );
+    add( MAX_PIXEL, stats.maximumPixel );
+    add( MIN_PIXEL, stats.minimumPixel );
+    add( SHUTTER, stats.shutter );
+    add( FRAME_PERIOD, stats.framePeriod );
+    count++;
+    samples++;
+
+    // Squal tops out at 169, so eight even buckets of 22.
+    int index = squal / 22;
+    bucket( squal_hist, index < TELEMETRY_BUCKETS ? index : TELEMETRY_BUCKETS - 1 );
+
+    // The shutter spans a few decades, one bucket per doubling from 256 up.
+    index = 0;
+    for( uint16_t limit = 256; index < TELEMETRY_BUCKETS - 1 && stats.shutter >= limit; limit <<= 1 ){
+        index++;
+    }
+    bucket( shutter_hist, index );
+}
+
+void Telemetry::add( int channel, uint16_t val ){
+    if( val < min[channel] ){
+        min[channel] = val;
+    }
+    if( val > max[channel] ){
+        max[channel] = val;
+    }
+    sum[channel] += val;
+}
+
+void Telemetry::bucket( uint16_t *hist, int index ){
+    if( hist[index] == 0xffff ){
+        for( int i = 0; i < TELEMETRY_BUCKETS; i++ ){
+            hist[i] >>= 1;
+        }
+    }
+    hist[index]++;
+}
+
+void Telemetry::put_hist( uint8_t *data, const uint16_t *hist ){
+    uint32_t total = 0;
+    for( int i = 0; i < TELEMETRY_BUCKETS; i++ ){
+        total += hist[i];
+    }
+    for( int i = 0; i < TELEMETRY_BUCKETS; i++ ){
+        data[i] = total ? (hist[i] * 255UL) / total : 0;
+    }
+}
+
+uint8_t Telemetry::report( uint8_t *data, uint8_t len ){
+    uint8_t *p = &data[1];
+
+    *p++ = TELEMETRY_VERSION;
+    *p++ = interval;
+    *p++ = samples & 0xff;
+    *p++ = (samples >> 8) & 0xff;
+    *p++ = (samples >> 16) & 0xff;
+    *p++ = (samples >> 24) & 0xff;
+
+    for( int i = 0; i < CHANNELS; i++ ){
+        uint16_t mean = count ? sum[i] / count : 0;
+        PUT_UINT16( p, count ? min[i] : 0 );
+        PUT_UINT16( p + 2, max[i] );
+        PUT_UINT16( p + 4, mean );
+        p += 6;
+    }
+
+    put_hist( p, squal_hist );
+    p += TELEMETRY_BUCKETS;
+    put_hist( p, shutter_hist );
+    p += TELEMETRY_BUCKETS;
+
+    while( p < data + len ){
+        *p++ = 0;
+    }
+    return p - data;
+}
@@ -0,0 +1,90 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include "adns9500.hpp"
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_BUCKETS 8
+
+/*
+ * Running statistics of the sensor burst data, for spotting a failing ball
+ * or dirty optics from the host. Every channel keeps its min, max and mean,
+ * the surface quality and shutter also keep a histogram.
+ *
+ * The mean is over a sliding window: the sums are halved once the sample
+ * count reaches TELEMETRY_WINDOW, so old samples fade out. Histogram buckets
+ * are halved the same way when one of them is about to overflow.
+ *
+ * Feature report layout, all 16 bit values little endian:
+ *
+ *     Byte  | Content
+ *    -------+----------------------------------------------------------
+ *      0    | Report ID
+ *      1    | TELEMETRY_VERSION
+ *      2    | Motion bursts per sample
+ *      3-6  | Samples taken since the last reset (32 bit)
+ *      7-42 | min, max, mean for squal, pixel sum, max pixel, min pixel,
+ *           | shutter and frame period
+ *     43-50 | Squal histogram, share of each bucket scaled to 0-255
+ *     51-58 | Shutter histogram, share of each bucket scaled to 0-255
+ *     59-   | Zero
+ */
+class Telemetry {
+    public:
+        enum channels {
+            SQUAL = 0x00,
+            PIXEL_SUM,
+            MAX_PIXEL,
+            MIN_PIXEL,
+            SHUTTER,
+            FRAME_PERIOD,
+            CHANNELS
+        };
+
+        Telemetry( uint8_t interval );
+
+        void reset( void );
+
+        // Add the data of one motion burst.
+        void sample( uint8_t squal, const adns9500::MotionBurstStats& stats );
+
+        // Write the feature report after the report ID in data[0], zero
+        // padded to len, the length the report descriptor declares.
+        // Returns the report length, report ID included.
+        uint8_t report( uint8_t *data, uint8_t len );
+
+        // Motion bursts between two samples.
+        uint8_t interval;
+
+    private:
+        void add( int channel, uint16_t val );
+        void bucket( uint16_t *hist, int index );
+        void put_hist( uint8_t *data, const uint16_t *hist );
+
+        uint16_t min[CHANNELS];
+        uint16_t max[CHANNELS];
+        uint32_t sum[CHANNELS];
+        uint16_t count;
+        uint32_t samples;
+        uint16_t squal_hist[TELEMETRY_BUCKETS];
+        uint16_t shutter_hist[TELEMETRY_BUCKETS];
+};
+
+#endif
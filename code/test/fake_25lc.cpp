@@ -0,0 +1,113 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "fake_25lc.h"
+
+#define CMD_READ  0x03
+#define CMD_WRITE 0x02
+#define CMD_WRDI  0x04
+#define CMD_RDSR  0x05
+#define CMD_WREN  0x06
+
+#define STATUS_WIP 0x01
+#define STATUS_WEL 0x02
+
+Fake25LC::Fake25LC( PinName sclk, PinName cs, uint32_t size, uint32_t page_size )
+    : page_writes(0), stalls(0), unlatched(0), cs_pin(cs), size(size),
+      page_size(page_size), busy_until(0), latch(false), pos(0), command(0){
+    memset( mem, 0xff, sizeof(mem) );
+    sim_attach_spi( sclk, cs, this );
+}
+
+Fake25LC::~Fake25LC(){
+    sim_detach_spi( cs_pin );
+}
+
+bool Fake25LC::busy(){
+    return sim_now_ns() < busy_until;
+}
+
+void Fake25LC::select( bool selected ){
+    if( selected ){
+        pos = 0;
+        page_len = 0;
+        return;
+    }
+
+    // Raising /CS after the data of a WRITE starts the write cycle.
+    if( command == CMD_WRITE && pos > 3 && !busy() ){
+        if( !latch ){
+            unlatched++;
+        }
+        else{
+            uint32_t base = address - address % page_size;
+            for( uint32_t i = 0; i < page_len; i++ ){
+                mem[base + (address + i) % page_size] = page[i];
+            }
+            busy_until = sim_now_ns() + FAKE_25LC_TWC_US * 1000ULL;
+            page_writes++;
+        }
+        latch = false;
+    }
+    command = 0;
+}
+
+int Fake25LC::transfer( int out ){
+    int p = pos++;
+
+    if( p == 0 ){
+        command = out;
+        if( busy() && command != CMD_RDSR ){
+            stalls++;
+            command = 0;
+        }
+        else if( command == CMD_WREN ){
+            latch = true;
+        }
+        else if( command == CMD_WRDI ){
+            latch = false;
+        }
+        return 0xff;
+    }
+
+    switch( command ){
+        case CMD_RDSR:
+            return (busy() ? STATUS_WIP : 0) | (latch ? STATUS_WEL : 0);
+
+        case CMD_READ:
+        case CMD_WRITE:
+            if( p == 1 ){
+                address = out << 8;
+                return 0xff;
+            }
+            if( p == 2 ){
+                address = (address | out) % size;
+                return 0xff;
+            }
+            if( command == CMD_READ ){
+                // Reads run on through the whole part.
+                return mem[(address + p - 3) % size];
+            }
+            if( page_len < page_size ){
+                page[page_len++] = out;
+            }
+            return 0xff;
+
+        default:
+            // Nothing the part listens to, or ignored while busy.
+            return 0xff;
+    }
+}
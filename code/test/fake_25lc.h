@@ -0,0 +1,62 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef FAKE_25LC_H
+#define FAKE_25LC_H
+
+#include <stdint.h>
+#include "mbed.h"
+
+// Write cycle time of the 25LC parts, the WIP bit is set this long.
+#define FAKE_25LC_TWC_US 5000
+
+/*
+ * A 25LCxxx EEPROM as seen from its SPI port, two address bytes. READ,
+ * WRITE, RDSR, WREN and WRDI are modelled. A write wraps within its page
+ * like the real part and only lands at the end of the write cycle, with
+ * the WIP bit set until then. Any other command during the write cycle is
+ * ignored by the part and counted as a stall, a read returns garbage.
+ */
+class Fake25LC : public SpiDevice {
+    public:
+        Fake25LC( PinName sclk, PinName cs, uint32_t size = 0x10000, uint32_t page_size = 0x20 );
+        ~Fake25LC();
+
+        virtual void select( bool selected );
+        virtual int transfer( int out );
+
+        bool busy( void );
+
+        uint8_t mem[0x10000];
+        uint32_t page_writes;
+        uint32_t stalls;
+        // Writes refused for want of a WREN.
+        uint32_t unlatched;
+
+    private:
+        PinName cs_pin;
+        uint32_t size;
+        uint32_t page_size;
+        uint64_t busy_until;
+        bool latch;
+        int pos;
+        uint8_t command;
+        uint32_t address;
+        uint8_t page[256];
+        uint32_t page_len;
+};
+
+#endif
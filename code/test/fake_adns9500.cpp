@@ -0,0 +1,285 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "fake_adns9500.h"
+
+// Datasheet minimums, in ns.
+static const uint64_t rule_ns[FakeAdns9500::RULES] = {
+    20000,  // tSRR
+    20000,  // tSRW
+    120000, // tSWR
+    120000, // tSWW
+    100000, // tSRAD
+    15000   // tLOAD
+};
+
+const char *FakeAdns9500::rule_names[RULES] = {
+    "tSRR", "tSRW", "tSWR", "tSWW", "tSRAD", "tLOAD"
+};
+
+#define REG_PRODUCT_ID      0x00
+#define REG_REVISION_ID     0x01
+#define REG_MOTION          0x02
+#define REG_DELTA_X_L       0x03
+#define REG_DELTA_X_H       0x04
+#define REG_DELTA_Y_L       0x05
+#define REG_DELTA_Y_H       0x06
+#define REG_SQUAL           0x07
+#define REG_SROM_ENABLE     0x13
+#define REG_FRAME_PERIOD_MAX_BOUND_LOWER 0x1a
+#define REG_FRAME_PERIOD_MAX_BOUND_UPPER 0x1b
+#define REG_FRAME_PERIOD_MIN_BOUND_LOWER 0x1c
+#define REG_FRAME_PERIOD_MIN_BOUND_UPPER 0x1d
+#define REG_SHUTTER_MAX_BOUND_LOWER      0x1e
+#define REG_SHUTTER_MAX_BOUND_UPPER      0x1f
+#define REG_OBSERVATION     0x24
+#define REG_DATA_OUT_LOWER  0x25
+#define REG_DATA_OUT_UPPER  0x26
+#define REG_SROM_ID         0x2a
+#define REG_POWER_UP_RESET  0x3a
+#define REG_MOTION_BURST    0x50
+#define REG_SROM_LOAD_BURST 0x62
+
+FakeAdns9500::FakeAdns9500( PinName sclk, PinName ncs, PinName motion )
+    : pixel_sum(0x20), max_pixel(0x80), min_pixel(0x10), shutter(0x0100),
+      frame_period(24000), reads(0), writes(0), bursts(0), ncs_pin(ncs),
+      motion_pin(motion){
+    for( int i = 0; i < RULES; i++ ){
+        violations[i] = 0;
+        closest[i] = UINT64_MAX;
+    }
+    power_up();
+    sim_attach_spi( sclk, ncs, this );
+}
+
+FakeAdns9500::~FakeAdns9500(){
+    sim_detach_spi( ncs_pin );
+}
+
+void FakeAdns9500::power_up(){
+    memset( regs, 0, sizeof(regs) );
+    regs[REG_PRODUCT_ID] = 0x33;
+    regs[REG_REVISION_ID] = 0x03;
+    regs[REG_SQUAL] = 0x40;
+    set16( REG_FRAME_PERIOD_MAX_BOUND_UPPER, REG_FRAME_PERIOD_MAX_BOUND_LOWER, 24000 );
+    set16( REG_FRAME_PERIOD_MIN_BOUND_UPPER, REG_FRAME_PERIOD_MIN_BOUND_LOWER, 4000 );
+    set16( REG_SHUTTER_MAX_BOUND_UPPER, REG_SHUTTER_MAX_BOUND_LOWER, 20000 );
+    latch_bounds();
+    phase = ADDRESS;
+    any = false;
+    acc_x = acc_y = 0;
+    latched_x = latched_y = 0;
+    srom_len = 0;
+    srom_running = false;
+    sim_set_pin( motion_pin, 1 );
+}
+
+void FakeAdns9500::set16( uint8_t upper, uint8_t lower, uint16_t value ){
+    regs[upper] = value >> 8;
+    regs[lower] = value & 0xff;
+}
+
+uint16_t FakeAdns9500::get16( uint8_t upper, uint8_t lower ){
+    return regs[upper] << 8 | regs[lower];
+}
+
+// All three bounds take effect together, on the write of the max bound.
+void FakeAdns9500::latch_bounds(){
+    frame_period_max_bound = get16( REG_FRAME_PERIOD_MAX_BOUND_UPPER, REG_FRAME_PERIOD_MAX_BOUND_LOWER );
+    frame_period_min_bound = get16( REG_FRAME_PERIOD_MIN_BOUND_UPPER, REG_FRAME_PERIOD_MIN_BOUND_LOWER );
+    shutter_max_bound = get16( REG_SHUTTER_MAX_BOUND_UPPER, REG_SHUTTER_MAX_BOUND_LOWER );
+}
+
+void FakeAdns9500::move( int16_t dx, int16_t dy ){
+    acc_x += dx;
+    acc_y += dy;
+    if( acc_x || acc_y ){
+        sim_set_pin( motion_pin, 0 );
+    }
+}
+
+// Freeze the counts for reading, the pin stays low only for newer ones.
+void FakeAdns9500::latch(){
+    latched_x = acc_x > INT16_MAX ? INT16_MAX : acc_x < INT16_MIN ? INT16_MIN : acc_x;
+    latched_y = acc_y > INT16_MAX ? INT16_MAX : acc_y < INT16_MIN ? INT16_MIN : acc_y;
+    acc_x = acc_y = 0;
+    sim_set_pin( motion_pin, 1 );
+}
+
+void FakeAdns9500::check( int rule, uint64_t since, uint64_t min_ns ){
+    uint64_t gap = sim_spi_start_ns - since;
+    if( gap < closest[rule] ){
+        closest[rule] = gap;
+    }
+    if( gap < min_ns ){
+        violations[rule]++;
+    }
+}
+
+void FakeAdns9500::select( bool selected ){
+    // Raising ncs ends a burst, lowering it starts a new transaction.
+    if( phase == SROM_BURST && srom_len ){
+        srom_running = true;
+    }
+    phase = ADDRESS;
+}
+
+int FakeAdns9500::transfer( int out ){
+    switch( phase ){
+        case ADDRESS:
+        {
+            bool read = !(out & 0x80);
+            if( any ){
+                int rule = last_read ? (read ? TSRR : TSRW) : (read ? TSWR : TSWW);
+                check( rule, last_end, rule_ns[rule] );
+            }
+            address = out & 0x7f;
+            address_end = sim_now_ns();
+            if( out == REG_MOTION_BURST ){
+                latch();
+                int motion = (latched_x || latched_y) ? 0x80 : 0x00;
+                uint8_t b[14] = {
+                    (uint8_t)motion, 0x3f,
+                    (uint8_t)(latched_x & 0xff), (uint8_t)(latched_x >> 8),
+                    (uint8_t)(latched_y & 0xff), (uint8_t)(latched_y >> 8),
+                    regs[REG_SQUAL], pixel_sum, max_pixel, min_pixel,
+                    (uint8_t)(shutter >> 8), (uint8_t)(shutter & 0xff),
+                    (uint8_t)(frame_period >> 8), (uint8_t)(frame_period & 0xff)
+                };
+                memcpy( burst, b, sizeof(burst) );
+                latched_x = latched_y = 0;
+                burst_pos = 0;
+                bursts++;
+                phase = MOTION_BURST;
+            }
+            else if( out == (REG_SROM_LOAD_BURST | 0x80) ){
+                srom_len = 0;
+                byte_end = address_end;
+                bursts++;
+                phase = SROM_BURST;
+            }
+            else{
+                phase = read ? READ_DATA : WRITE_DATA;
+            }
+            return 0;
+        }
+
+        case READ_DATA:
+            check( TSRAD, address_end, rule_ns[TSRAD] );
+            reads++;
+            last_end = sim_now_ns();
+            last_read = true;
+            any = true;
+            phase = ADDRESS;
+            return reg_read( address );
+
+        case WRITE_DATA:
+            writes++;
+            last_end = sim_now_ns();
+            last_read = false;
+            any = true;
+            phase = ADDRESS;
+            reg_write( address, out );
+            return 0;
+
+        case MOTION_BURST:
+            if( burst_pos == 0 ){
+                check( TSRAD, address_end, rule_ns[TSRAD] );
+            }
+            last_end = sim_now_ns();
+            last_read = true;
+            any = true;
+            return burst_pos < (int)sizeof(burst) ? burst[burst_pos++] : 0;
+
+        case SROM_BURST:
+            check( TLOAD, byte_end, rule_ns[TLOAD] );
+            if( srom_len < sizeof(srom) ){
+                srom[srom_len++] = out;
+            }
+            byte_end = last_end = sim_now_ns();
+            last_read = false;
+            any = true;
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+int FakeAdns9500::reg_read( uint8_t address ){
+    switch( address ){
+        case REG_MOTION:
+            latch();
+            return (latched_x || latched_y) ? 0x80 : 0x00;
+        case REG_DELTA_X_L:
+            return latched_x & 0xff;
+        case REG_DELTA_X_H:
+            return (latched_x >> 8) & 0xff;
+        case REG_DELTA_Y_L:
+            return latched_y & 0xff;
+        case REG_DELTA_Y_H:
+        {
+            int v = (latched_y >> 8) & 0xff;
+            latched_x = latched_y = 0;
+            return v;
+        }
+        case REG_OBSERVATION:
+            // The sensor sets the low bits again every frame.
+            return 0x3f;
+        case REG_SROM_ID:
+            return srom_running ? 0x56 : 0x00;
+        default:
+            return regs[address];
+    }
+}
+
+void FakeAdns9500::reg_write( uint8_t address, uint8_t value ){
+    switch( address ){
+        case REG_POWER_UP_RESET:
+            if( value == 0x5a ){
+                power_up();
+            }
+            return;
+        case REG_MOTION:
+            acc_x = acc_y = 0;
+            latched_x = latched_y = 0;
+            sim_set_pin( motion_pin, 1 );
+            return;
+        case REG_SROM_ENABLE:
+            if( value == 0x15 ){
+                // No idea what the real CRC is, any checksum of the image will
+                // do to tell two downloads apart.
+                uint16_t crc = 0xffff;
+                for( int i = 0; i < srom_len; i++ ){
+                    crc ^= srom[i] << 8;
+                    for( int b = 0; b < 8; b++ ){
+                        crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+                    }
+                }
+                regs[REG_DATA_OUT_LOWER] = crc & 0xff;
+                regs[REG_DATA_OUT_UPPER] = crc >> 8;
+            }
+            regs[address] = value;
+            return;
+        case REG_FRAME_PERIOD_MAX_BOUND_UPPER:
+            regs[address] = value;
+            latch_bounds();
+            return;
+        default:
+            regs[address] = value;
+            return;
+    }
+}
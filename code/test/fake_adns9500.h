@@ -0,0 +1,115 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef FAKE_ADNS9500_H
+#define FAKE_ADNS9500_H
+
+#include <stdint.h>
+#include "mbed.h"
+
+/*
+ * The ADNS-9500 as seen from its SPI port. Registers, the motion and SROM
+ * bursts and the motion pin are modelled, the optics are not: move() hands
+ * it the counts the next frame would see.
+ *
+ * Every transaction is checked against the timing of the datasheet, from
+ * the end of one transaction to the address byte of the next (tSRR, tSRW,
+ * tSWR, tSWW), from an address byte to its data (tSRAD) and between two
+ * SROM bytes (tLOAD). A gap that is too short is counted in violations[].
+ */
+class FakeAdns9500 : public SpiDevice {
+    public:
+        enum rules {
+            TSRR,
+            TSRW,
+            TSWR,
+            TSWW,
+            TSRAD,
+            TLOAD,
+            RULES
+        };
+
+        FakeAdns9500( PinName sclk, PinName ncs, PinName motion );
+        ~FakeAdns9500();
+
+        // Counts seen by the sensor, the motion pin goes low.
+        void move( int16_t dx, int16_t dy );
+
+        virtual void select( bool selected );
+        virtual int transfer( int out );
+
+        uint8_t regs[0x80];
+        // What the rest of the motion burst returns.
+        uint8_t pixel_sum;
+        uint8_t max_pixel;
+        uint8_t min_pixel;
+        uint16_t shutter;
+        uint16_t frame_period;
+        // Frame bounds in effect. The sensor only takes the bound registers
+        // when Frame_Period_Max_Bound_Upper is written, the last of them.
+        uint16_t frame_period_max_bound;
+        uint16_t frame_period_min_bound;
+        uint16_t shutter_max_bound;
+
+        // Register reads and writes, a burst counts as one.
+        uint32_t reads;
+        uint32_t writes;
+        uint32_t bursts;
+        uint32_t violations[RULES];
+        // Shortest gap seen for each rule, in ns.
+        uint64_t closest[RULES];
+        static const char *rule_names[RULES];
+
+        uint8_t srom[4096];
+        uint16_t srom_len;
+
+    private:
+        enum phases {
+            ADDRESS,
+            READ_DATA,
+            WRITE_DATA,
+            MOTION_BURST,
+            SROM_BURST
+        };
+        void check( int rule, uint64_t since, uint64_t min_ns );
+        int reg_read( uint8_t address );
+        void reg_write( uint8_t address, uint8_t value );
+        void latch( void );
+        void latch_bounds( void );
+        void set16( uint8_t upper, uint8_t lower, uint16_t value );
+        uint16_t get16( uint8_t upper, uint8_t lower );
+        void power_up( void );
+
+        PinName ncs_pin;
+        PinName motion_pin;
+        phases phase;
+        uint8_t address;
+        int burst_pos;
+        uint8_t burst[14];
+        // End of the last transaction, and whether it was a read.
+        uint64_t last_end;
+        bool last_read;
+        bool any;
+        uint64_t address_end;
+        uint64_t byte_end;
+        int32_t acc_x;
+        int32_t acc_y;
+        int16_t latched_x;
+        int16_t latched_y;
+        bool srom_running;
+};
+
+#endif
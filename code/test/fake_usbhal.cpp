@@ -0,0 +1,187 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "fake_usbhal.h"
+#include "USBDevice_Types.h"
+
+USBHAL * USBHAL::instance;
+
+static void (*isr)( void );
+static uint32_t pending;
+static uint32_t completed;
+static uint32_t frame;
+static uint8_t setup[8];
+static bool armed[NUMBER_OF_PHYSICAL_ENDPOINTS];
+static uint8_t buffers[NUMBER_OF_PHYSICAL_ENDPOINTS][MAX_PACKET_SIZE_EP1];
+static uint32_t lengths[NUMBER_OF_PHYSICAL_ENDPOINTS];
+
+void fake_usb_configure(){
+    // bmRequestType, bRequest, wValue, wIndex, wLength
+    const uint8_t request[8] = { 0x00, SET_CONFIGURATION, 1, 0, 0, 0, 0, 0 };
+    memcpy( setup, request, sizeof(setup) );
+    fake_usb_raise( FAKE_USB_EP(EP0OUT) );
+    fake_usb_isr();
+}
+
+void fake_usb_raise( uint32_t sources ){
+    if( sources & FAKE_USB_SOF ){
+        frame = (frame + 1) & 0x7ff;
+    }
+    pending |= sources;
+}
+
+void fake_usb_isr(){
+    if( isr ){
+        isr();
+    }
+}
+
+bool fake_usb_poll( uint8_t endpoint, uint8_t *data, uint32_t *length ){
+    if( !armed[endpoint] ){
+        return false;
+    }
+    armed[endpoint] = false;
+    memcpy( data, buffers[endpoint], lengths[endpoint] );
+    *length = lengths[endpoint];
+    fake_usb_raise( FAKE_USB_EP(endpoint) );
+    return true;
+}
+
+uint32_t fake_usb_frame(){
+    return frame;
+}
+
+USBHAL::USBHAL(){
+    epCallback[0] = &USBHAL::EP1_OUT_callback;
+    epCallback[1] = &USBHAL::EP1_IN_callback;
+    epCallback[2] = &USBHAL::EP2_OUT_callback;
+    epCallback[3] = &USBHAL::EP2_IN_callback;
+    epCallback[4] = &USBHAL::EP3_OUT_callback;
+    epCallback[5] = &USBHAL::EP3_IN_callback;
+    epCallback[6] = &USBHAL::EP4_OUT_callback;
+    epCallback[7] = &USBHAL::EP4_IN_callback;
+
+    pending = 0;
+    completed = 0;
+    frame = 0;
+    memset( armed, 0, sizeof(armed) );
+    instance = this;
+    isr = &USBHAL::_usbisr;
+}
+
+USBHAL::~USBHAL(){
+    if( instance == this ){
+        isr = 0;
+        instance = 0;
+    }
+}
+
+void USBHAL::connect() {}
+void USBHAL::disconnect() {}
+void USBHAL::configureDevice() {}
+void USBHAL::unconfigureDevice() {}
+void USBHAL::setAddress( uint8_t address ) {}
+void USBHAL::remoteWakeup() {}
+
+void USBHAL::EP0setup( uint8_t *buffer ){
+    memcpy( buffer, setup, sizeof(setup) );
+}
+
+void USBHAL::EP0read() {}
+void USBHAL::EP0readStage() {}
+
+uint32_t USBHAL::EP0getReadResult( uint8_t *buffer ){
+    return 0;
+}
+
+// Status and data stages are taken by the host at once, never acknowledged.
+void USBHAL::EP0write( uint8_t *buffer, uint32_t size ) {}
+void USBHAL::EP0getWriteResult() {}
+void USBHAL::EP0stall() {}
+
+EP_STATUS USBHAL::endpointRead( uint8_t endpoint, uint32_t maximumSize ){
+    return EP_PENDING;
+}
+
+EP_STATUS USBHAL::endpointReadResult( uint8_t endpoint, uint8_t *data, uint32_t *bytesRead ){
+    return EP_PENDING;
+}
+
+EP_STATUS USBHAL::endpointWrite( uint8_t endpoint, uint8_t *data, uint32_t size ){
+    if( armed[endpoint] || size > MAX_PACKET_SIZE_EP1 ){
+        return EP_INVALID;
+    }
+    memcpy( buffers[endpoint], data, size );
+    lengths[endpoint] = size;
+    armed[endpoint] = true;
+    return EP_PENDING;
+}
+
+EP_STATUS USBHAL::endpointWriteResult( uint8_t endpoint ){
+    if( completed & FAKE_USB_EP(endpoint) ){
+        completed &= ~FAKE_USB_EP(endpoint);
+        return EP_COMPLETED;
+    }
+    return EP_PENDING;
+}
+
+void USBHAL::stallEndpoint( uint8_t endpoint ) {}
+void USBHAL::unstallEndpoint( uint8_t endpoint ) {}
+
+bool USBHAL::realiseEndpoint( uint8_t endpoint, uint32_t maxPacket, uint32_t options ){
+    return true;
+}
+
+bool USBHAL::getEndpointStallState( unsigned char endpoint ){
+    return false;
+}
+
+uint32_t USBHAL::endpointReadcore( uint8_t endpoint, uint8_t *buffer ){
+    return 0;
+}
+
+void USBHAL::_usbisr(){
+    instance->usbisr();
+}
+
+// Same order as USBHAL_LPC11U.cpp, the start of frame goes before the
+// endpoints even when both are pending.
+void USBHAL::usbisr(){
+    if( pending & FAKE_USB_SOF ){
+        pending &= ~FAKE_USB_SOF;
+        SOF( frame );
+    }
+
+    if( pending & FAKE_USB_EP(EP0OUT) ){
+        pending &= ~FAKE_USB_EP(EP0OUT);
+        EP0setupCallback();
+    }
+
+    if( pending & FAKE_USB_EP(EP0IN) ){
+        pending &= ~FAKE_USB_EP(EP0IN);
+        EP0in();
+    }
+
+    for( uint8_t num = 2; num < NUMBER_OF_PHYSICAL_ENDPOINTS; num++ ){
+        if( pending & FAKE_USB_EP(num) ){
+            pending &= ~FAKE_USB_EP(num);
+            completed |= FAKE_USB_EP(num);
+            if( (instance->*(epCallback[num - 2]))() ){
+                completed &= ~FAKE_USB_EP(num);
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef FAKE_USBHAL_H
+#define FAKE_USBHAL_H
+
+#include <stdint.h>
+#include "USBHAL.h"
+
+// Interrupt sources, an endpoint by its physical number.
+#define FAKE_USB_SOF   (1UL << 31)
+#define FAKE_USB_EP(n) (1UL << (n))
+
+/*
+ * The USB controller under USBHAL, driven by a host that only does what the
+ * test tells it. Interrupt sources are latched by fake_usb_raise() and all
+ * handled by one fake_usb_isr(), in the order the LPC11U24 driver handles
+ * them: start of frame first, then endpoint 0, then the other endpoints.
+ *
+ * An IN endpoint write is held until the host polls it. The poll takes
+ * the data and latches the completion interrupt of the endpoint.
+ */
+
+// The SET_CONFIGURATION request of an enumeration, configuration 1.
+void fake_usb_configure( void );
+void fake_usb_raise( uint32_t sources );
+void fake_usb_isr( void );
+// The host polls an IN endpoint. Returns false on a NAK, nothing written.
+bool fake_usb_poll( uint8_t endpoint, uint8_t *data, uint32_t *length );
+// Current frame number, moved on by every FAKE_USB_SOF.
+uint32_t fake_usb_frame( void );
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include <stdarg.h>
+#include "mbed.h"
+#include "us_ticker_api.h"
+
+uint32_t sim_spi_bytes;
+uint64_t sim_spi_ns;
+uint64_t sim_spi_start_ns;
+uint32_t sim_errors;
+char sim_error_text[128];
+int sim_irq_masked;
+uint32_t sim_mallocs;
+uint32_t sim_console_baud;
+
+static uint64_t now_ns;
+static int levels[SIM_PINS];
+static SpiDevice *devices[SIM_PINS];
+static PinName buses[SIM_PINS];
+static InterruptIn *interrupts[SIM_PINS];
+
+uint64_t sim_now_ns(){
+    return now_ns;
+}
+
+void sim_advance_ns( uint64_t ns ){
+    now_ns += ns;
+}
+
+// Everything back to power on, pins pulled up. Hooked up devices stay.
+void sim_reset(){
+    now_ns = 0;
+    for( int i = 0; i < SIM_PINS; i++ ){
+        levels[i] = 1;
+    }
+    sim_spi_bytes = 0;
+    sim_spi_ns = 0;
+    sim_errors = 0;
+    sim_error_text[0] = 0;
+    sim_irq_masked = 0;
+    sim_mallocs = 0;
+    sim_console_baud = 0;
+}
+
+void sim_attach_spi( PinName sclk, PinName cs, SpiDevice *device ){
+    devices[cs] = device;
+    buses[cs] = sclk;
+    device->select( levels[cs] == 0 );
+}
+
+void sim_detach_spi( PinName cs ){
+    devices[cs] = NULL;
+}
+
+void sim_set_pin( PinName pin, int level ){
+    level = level ? 1 : 0;
+    if( pin == NC || levels[pin] == level ){
+        return;
+    }
+    levels[pin] = level;
+    if( devices[pin] ){
+        devices[pin]->select( level == 0 );
+    }
+    if( interrupts[pin] ){
+        interrupts[pin]->edge( level );
+    }
+}
+
+int sim_pin( PinName pin ){
+    // Not connected reads as pulled up.
+    return pin == NC ? 1 : levels[pin];
+}
+
+int SPI::write( int value ){
+    sim_spi_start_ns = now_ns;
+    now_ns += _byte_ns;
+    sim_spi_bytes++;
+    sim_spi_ns += _byte_ns;
+
+    for( int i = 0; i < SIM_PINS; i++ ){
+        if( devices[i] && buses[i] == _sclk && levels[i] == 0 ){
+            return devices[i]->transfer( value & 0xff ) & 0xff;
+        }
+    }
+    // Nothing selected, miso floats high.
+    return 0xff;
+}
+
+void DigitalOut::write( int value ){
+    sim_set_pin( _pin, value );
+}
+
+InterruptIn::InterruptIn( PinName pin ) : _pin(pin){
+    if( pin != NC ){
+        interrupts[pin] = this;
+    }
+}
+
+InterruptIn::~InterruptIn(){
+    if( _pin != NC && interrupts[_pin] == this ){
+        interrupts[_pin] = NULL;
+    }
+}
+
+extern "C" void *__real_malloc( size_t size );
+
+extern "C" void *__wrap_malloc( size_t size ){
+    sim_mallocs++;
+    return __real_malloc( size );
+}
+
+uint32_t us_ticker_read(){
+    now_ns += SIM_TICKER_READ_NS;
+    return (uint32_t)(now_ns / 1000);
+}
+
+void wait( float s ){
+    now_ns += (uint64_t)(s * 1e9f);
+}
+
+void wait_ms( int ms ){
+    now_ns += (uint64_t)ms * 1000000;
+}
+
+void wait_us( int us ){
+    now_ns += (uint64_t)us * 1000;
+}
+
+void error( const char *format, ... ){
+    va_list args;
+    va_start( args, format );
+    vsnprintf( sim_error_text, sizeof(sim_error_text), format, args );
+    va_end( args );
+    sim_errors++;
+}
+
+int sim_printf( const char *format, ... ){
+    va_list args;
+    va_start( args, format );
+    int len = vsnprintf( NULL, 0, format, args );
+    va_end( args );
+    if( sim_console_baud && len > 0 ){
+        sim_advance_ns( len * 10000000000ULL / sim_console_baud );
+    }
+    return len;
+}
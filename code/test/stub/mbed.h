@@ -0,0 +1,266 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef MBED_H
+#define MBED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * Host stand-in for the parts of the mbed library the firmware uses.
+ *
+ * Time is simulated. It only moves on a wait, on every SPI byte (at the
+ * frequency the port was set to) and by SIM_TICKER_READ_NS on every ticker
+ * read, so a busy loop on the ticker ends and every run gives the same
+ * numbers.
+ *
+ * SPI devices are modelled by SpiDevice classes hooked to their port and
+ * chip select pin. A write to that DigitalOut selects or deselects the
+ * device, SPI bytes go to the selected device on the port. Inputs are simulated pins, driven from
+ * the tests or the device models, a falling edge on an InterruptIn pin calls
+ * its handler right away like the interrupt would.
+ */
+
+// Cost of reading the us ticker, about what the real call takes.
+#define SIM_TICKER_READ_NS 100
+
+typedef int PinName;
+enum {
+    NC = -1,
+    p5 = 5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19,
+    p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30,
+    SIM_PINS = 64
+};
+enum PinMode {
+    PullUp,
+    PullDown,
+    PullNone
+};
+
+class SpiDevice {
+    public:
+        virtual ~SpiDevice() {}
+        // Chip select changed.
+        virtual void select( bool selected ) = 0;
+        // One byte each way, called at the end of the byte. It started at
+        // sim_spi_start_ns.
+        virtual int transfer( int out ) = 0;
+};
+
+// Simulated time in ns since the start of the run.
+uint64_t sim_now_ns( void );
+void sim_advance_ns( uint64_t ns );
+void sim_reset( void );
+// A device on the SPI port clocked by sclk, selected by a low level on its
+// chip select pin.
+void sim_attach_spi( PinName sclk, PinName cs, SpiDevice *device );
+void sim_detach_spi( PinName cs );
+void sim_set_pin( PinName pin, int level );
+int sim_pin( PinName pin );
+// Bytes clocked on every SPI port so far, and the time they took.
+extern uint32_t sim_spi_bytes;
+extern uint64_t sim_spi_ns;
+extern uint64_t sim_spi_start_ns;
+// error() calls, the real one never returns.
+extern uint32_t sim_errors;
+extern char sim_error_text[128];
+// __disable_irq() nesting, 0 when interrupts are enabled.
+extern int sim_irq_masked;
+// malloc() calls from the firmware, the link wraps it (-Wl,--wrap=malloc).
+extern uint32_t sim_mallocs;
+
+class FunctionPointer {
+    public:
+        FunctionPointer( void (*function)(void) = 0 ){
+            attach( function );
+        }
+        template<typename T>
+        FunctionPointer( T *object, void (T::*member)(void) ){
+            attach( object, member );
+        }
+        void attach( void (*function)(void) ){
+            _function = function;
+            _object = 0;
+        }
+        template<typename T>
+        void attach( T *object, void (T::*member)(void) ){
+            _function = 0;
+            _object = object;
+            memcpy( _member, (char*)&member, sizeof(member) );
+            _caller = &FunctionPointer::caller<T>;
+        }
+        void call( void ){
+            if( _function ){
+                _function();
+            }
+            else if( _object ){
+                _caller( _object, _member );
+            }
+        }
+    private:
+        template<typename T>
+        static void caller( void *object, char *member ){
+            void (T::*m)(void);
+            memcpy( (char*)&m, member, sizeof(m) );
+            (((T*)object)->*m)();
+        }
+        void (*_function)(void);
+        void *_object;
+        char _member[16];
+        void (*_caller)(void*, char*);
+};
+
+class SPI {
+    public:
+        SPI( PinName mosi, PinName miso, PinName sclk ) : _sclk(sclk), _byte_ns(8000) {}
+        void format( int bits, int mode = 0 ) {}
+        void frequency( int hz = 1000000 ){
+            _byte_ns = 8000000000ULL / hz;
+        }
+        int write( int value );
+    private:
+        PinName _sclk;
+        uint64_t _byte_ns;
+};
+
+class DigitalOut {
+    public:
+        DigitalOut( PinName pin ) : _pin(pin) {}
+        void write( int value );
+        int read( void ){
+            return sim_pin( _pin );
+        }
+        DigitalOut& operator= ( int value ){
+            write( value );
+            return *this;
+        }
+        operator int(){
+            return read();
+        }
+    private:
+        PinName _pin;
+};
+
+class DigitalIn {
+    public:
+        DigitalIn( PinName pin ) : _pin(pin) {}
+        void mode( PinMode pull ) {}
+        int read( void ){
+            return sim_pin( _pin );
+        }
+        operator int(){
+            return read();
+        }
+    private:
+        PinName _pin;
+};
+
+class InterruptIn {
+    public:
+        InterruptIn( PinName pin );
+        ~InterruptIn();
+        void mode( PinMode pull ) {}
+        int read( void ){
+            return sim_pin( _pin );
+        }
+        void fall( void (*function)(void) ){
+            _fall.attach( function );
+        }
+        template<typename T>
+        void fall( T *object, void (T::*member)(void) ){
+            _fall.attach( object, member );
+        }
+        void rise( void (*function)(void) ){
+            _rise.attach( function );
+        }
+        // Called by sim_set_pin() on an edge.
+        void edge( int level ){
+            if( level ){
+                _rise.call();
+            }
+            else{
+                _fall.call();
+            }
+        }
+    private:
+        PinName _pin;
+        FunctionPointer _fall;
+        FunctionPointer _rise;
+};
+
+class Timer {
+    public:
+        Timer() : _start(0), _running(false), _elapsed(0) {}
+        void start( void ){
+            if( !_running ){
+                _start = sim_now_ns();
+                _running = true;
+            }
+        }
+        void stop( void ){
+            _elapsed = now();
+            _running = false;
+        }
+        void reset( void ){
+            _start = sim_now_ns();
+            _elapsed = 0;
+        }
+        int read_us( void ){
+            return now() / 1000;
+        }
+        int read_ms( void ){
+            return now() / 1000000;
+        }
+        float read( void ){
+            return now() / 1e9f;
+        }
+    private:
+        uint64_t now( void ){
+            return _running ? _elapsed + sim_now_ns() - _start : _elapsed;
+        }
+        uint64_t _start;
+        bool _running;
+        uint64_t _elapsed;
+};
+
+void wait( float s );
+void wait_ms( int ms );
+void wait_us( int us );
+void error( const char *format, ... );
+
+// Only the tests print, the firmware chatter is dropped. It costs no time
+// unless sim_console_baud is set, then every character takes its ten bits
+// on the wire, as the mbed putc waits for each one to go out.
+int sim_printf( const char *format, ... );
+extern uint32_t sim_console_baud;
+#define printf sim_printf
+
+static inline void __disable_irq( void ){
+    sim_irq_masked++;
+}
+static inline void __enable_irq( void ){
+    if( sim_irq_masked ){
+        sim_irq_masked--;
+    }
+}
+static inline void __DMB( void ) {}
+static inline void __WFI( void ) {}
+
+#endif
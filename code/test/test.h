@@ -0,0 +1,55 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include "mbed.h"
+
+/*
+ * Just enough of a test runner for the host build. TEST() defines a test
+ * and adds it to the list, CHECK() records a failure and goes on with the
+ * test. Every test starts on a freshly reset simulation, see mbed.h.
+ */
+
+typedef void (*TestFunction)(void);
+
+struct TestCase {
+    TestCase( const char *name, TestFunction function );
+    const char *name;
+    TestFunction function;
+    TestCase *next;
+};
+
+#define TEST(name) \
+    static void test_##name( void ); \
+    static TestCase test_case_##name( #name, &test_##name ); \
+    static void test_##name( void )
+
+#define CHECK(cond) \
+    test_check( (cond), #cond, __FILE__, __LINE__ )
+
+#define CHECK_EQUAL(expected, actual) \
+    test_check_equal( (long long)(expected), (long long)(actual), #actual, __FILE__, __LINE__ )
+
+void test_check( bool ok, const char *what, const char *file, int line );
+void test_check_equal( long long expected, long long actual, const char *what, const char *file, int line );
+
+// Measurements worth seeing in the output, printed under the test name.
+void test_note( const char *format, ... );
+
+#endif
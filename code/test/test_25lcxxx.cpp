@@ -0,0 +1,118 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "fake_25lc.h"
+#include "Ser25lcxxx.h"
+
+#define EEPROM_SCLK p13
+#define EEPROM_CS   p15
+
+static bool add_chunk( void *context, const uint8_t *data, uint32_t len ){
+    uint32_t &sum = *(uint32_t*)context;
+    for( uint32_t i = 0; i < len; i++ ){
+        sum += data[i];
+    }
+    return true;
+}
+
+/*
+ * The reads the firmware uses fill the caller's buffer and never touch the
+ * heap, the old allocating read() still does, once per call.
+ */
+TEST(eeprom_reads_without_malloc){
+    Fake25LC fake( EEPROM_SCLK, EEPROM_CS );
+    for( int i = 0; i < 0x400; i++ ){
+        fake.mem[i] = (uint8_t)(i * 7);
+    }
+    SPI spi( p11, p12, EEPROM_SCLK );
+    spi.format( 8, 3 );
+    spi.frequency( 4000000 );
+    Ser25LCxxx eeprom( &spi, EEPROM_CS, 0x10000, 0x20 );
+
+    uint8_t buf[100];
+    uint8_t fixed[64];
+    uint8_t chunk[16];
+    uint32_t sum = 0;
+    uint32_t want = 0;
+    for( int i = 0x100; i < 0x300; i++ ){
+        want += fake.mem[i];
+    }
+
+    uint32_t mallocs = sim_mallocs;
+    CHECK( eeprom.read( 0x10, sizeof(buf), buf ) );
+    CHECK( eeprom.readInto( 0x40, fixed ) );
+    CHECK( eeprom.readStream( 0x100, 0x200, chunk, sizeof(chunk), &add_chunk, &sum ) );
+    CHECK_EQUAL( 0, sim_mallocs - mallocs );
+
+    CHECK( memcmp( buf, &fake.mem[0x10], sizeof(buf) ) == 0 );
+    CHECK( memcmp( fixed, &fake.mem[0x40], sizeof(fixed) ) == 0 );
+    CHECK_EQUAL( want, sum );
+
+    // Out of range, nothing read and nothing allocated either way.
+    CHECK( !eeprom.read( 0xfff0, sizeof(buf), buf ) );
+    CHECK( eeprom.read( 0xfff0, sizeof(buf) ) == NULL );
+    CHECK_EQUAL( 0, sim_mallocs - mallocs );
+
+    // The counter does see the heap.
+    uint8_t *copy = eeprom.read( 0x10, sizeof(buf) );
+    CHECK_EQUAL( 1, sim_mallocs - mallocs );
+    CHECK( copy != NULL && memcmp( copy, buf, sizeof(buf) ) == 0 );
+    free( copy );
+}
+
+// The settings layout of main.h, before and after it became one image.
+#define OLD_ADNS_FW_LEN    33
+#define OLD_PROFILE_BASE   0xff
+#define OLD_PROFILE_LEN    0x17
+#define SETTINGS_LEN       36
+#define PROFILE_LEN        26
+#define PROFILES           5
+#define SETTINGS_IMAGE_LEN (8 + (SETTINGS_LEN + PROFILES * PROFILE_LEN) * 2)
+
+/*
+ * Boot used to read the two firmware settings one value at a time and then
+ * each profile on its own. Now it is a single read of the whole image.
+ */
+TEST(eeprom_settings_load_time){
+    Fake25LC fake( EEPROM_SCLK, EEPROM_CS );
+    SPI spi( p11, p12, EEPROM_SCLK );
+    spi.format( 8, 3 );
+    spi.frequency( 8000000 );
+    Ser25LCxxx eeprom( &spi, EEPROM_CS, 0x10000, 0x20 );
+
+    uint8_t value[2];
+    uint8_t profile[OLD_PROFILE_LEN * 2];
+    const int before_len = 2 * sizeof(value) + PROFILES * sizeof(profile);
+    uint64_t start = sim_now_ns();
+    CHECK( eeprom.read( OLD_ADNS_FW_LEN * 2, sizeof(value), value ) );
+    CHECK( eeprom.read( OLD_ADNS_FW_LEN * 2 + 2, sizeof(value), value ) );
+    for( int i = 0; i < PROFILES; i++ ){
+        CHECK( eeprom.read( OLD_PROFILE_BASE + i * sizeof(profile), sizeof(profile), profile ) );
+    }
+    uint64_t before_ns = sim_now_ns() - start;
+
+    static uint8_t image[SETTINGS_IMAGE_LEN];
+    start = sim_now_ns();
+    CHECK( eeprom.readInto( 0, image ) );
+    uint64_t after_ns = sim_now_ns() - start;
+
+    test_note( "settings load: %llu us for %d bytes in 7 reads before, %llu us for %d bytes in one read now",
+        before_ns / 1000, before_len, after_ns / 1000, SETTINGS_IMAGE_LEN );
+    // The image holds every setting, byte for byte it is the cheaper read.
+    CHECK( after_ns * before_len < before_ns * SETTINGS_IMAGE_LEN );
+    CHECK_EQUAL( 0, fake.stalls );
+}
@@ -0,0 +1,383 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "fake_adns9500.h"
+#include "adns9500.hpp"
+
+// The sensor pins of the tracking firmware.
+#define SENSOR_SCLK   p7
+#define SENSOR_NCS    p8
+#define SENSOR_MOTION p14
+
+/*
+ * Bus time of one tracking loop read. getMotionDelta() is what the loop
+ * used to do, five register reads each paying tSRAD. The motion burst pays
+ * tSRAD once for the same counts.
+ */
+TEST(motion_burst_bus_time){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    sensor.reset();
+
+    const int polls = 100;
+    uint64_t delta_ns = 0;
+    uint64_t burst_ns = 0;
+    uint32_t delta_bytes = sim_spi_bytes;
+
+    for( int i = 0; i < polls; i++ ){
+        int16_t dx, dy;
+        fake.move( 5 + i, -3 );
+        uint64_t start = sim_now_ns();
+        CHECK( sensor.getMotionDelta( dx, dy ) );
+        delta_ns += sim_now_ns() - start;
+        CHECK_EQUAL( 5 + i, dx );
+        CHECK_EQUAL( -3, dy );
+        // The loop used to read once per 1ms frame.
+        wait_ms( 1 );
+    }
+    delta_bytes = sim_spi_bytes - delta_bytes;
+
+    uint32_t burst_bytes = sim_spi_bytes;
+    for( int i = 0; i < polls; i++ ){
+        adns9500::MotionBurst burst;
+        fake.move( 5 + i, -3 );
+        uint64_t start = sim_now_ns();
+        CHECK( sensor.getMotionBurst( burst ) );
+        burst_ns += sim_now_ns() - start;
+        CHECK_EQUAL( 5 + i, burst.dx );
+        CHECK_EQUAL( -3, burst.dy );
+        CHECK_EQUAL( 0x40, burst.squal );
+        wait_ms( 1 );
+    }
+    burst_bytes = sim_spi_bytes - burst_bytes;
+
+    test_note( "getMotionDelta: %llu us, %u bytes per poll",
+        delta_ns / polls / 1000, delta_bytes / polls );
+    test_note( "getMotionBurst: %llu us, %u bytes per poll",
+        burst_ns / polls / 1000, burst_bytes / polls );
+
+    CHECK( burst_ns * 3 < delta_ns );
+    CHECK( burst_bytes < delta_bytes );
+}
+
+static int motion_edges;
+
+static void motion_edge(){
+    motion_edges++;
+}
+
+/*
+ * The tracking loop only reads the sensor after the motion pin fell. The
+ * pin falls once for a run of motion and stays low until it is read, so the
+ * loop has to keep reading while motionPending() says there is more.
+ */
+TEST(motion_pin_interrupt){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    sensor.attach( &motion_edge );
+    sensor.reset();
+    motion_edges = 0;
+
+    adns9500::MotionBurst burst;
+    CHECK( !sensor.motionPending() );
+
+    fake.move( 3, 4 );
+    CHECK_EQUAL( 1, motion_edges );
+    CHECK( sensor.motionPending() );
+
+    // More counts before the read, no second edge.
+    fake.move( 1, 1 );
+    CHECK_EQUAL( 1, motion_edges );
+
+    CHECK( sensor.getMotionBurst( burst ) );
+    CHECK_EQUAL( 4, burst.dx );
+    CHECK_EQUAL( 5, burst.dy );
+    CHECK( !sensor.motionPending() );
+
+    // Nothing moved, nothing to read.
+    CHECK( !sensor.getMotionBurst( burst ) );
+    CHECK_EQUAL( 1, motion_edges );
+
+    fake.move( -2, 0 );
+    CHECK_EQUAL( 2, motion_edges );
+    CHECK( sensor.getMotionBurst( burst ) );
+    CHECK_EQUAL( -2, burst.dx );
+    CHECK_EQUAL( 0, burst.dy );
+}
+
+/*
+ * The delays between transactions are deadlines from the end of the last
+ * one, nothing is waited for twice. Back to back calls with no time in
+ * between have to keep every gap of the datasheet anyway.
+ */
+TEST(transaction_timing){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    sensor.reset();
+    sensor.resync();
+
+    adns9500::MotionBurst burst;
+    adns9500::MotionBurstStats stats;
+    int16_t dx, dy;
+    for( int i = 0; i < 20; i++ ){
+        fake.move( i, -i );
+        sensor.getMotionBurst( burst, i & 1 ? &stats : NULL );
+        sensor.setResolutionRegisters( 0x12 + (i & 3), 0x12 );
+        sensor.getMotionBurst( burst );
+        sensor.setRestMode( i & 1 ? adns9500::REST_1 : adns9500::REST_NONE );
+        sensor.read( adns9500::SQUAL );
+        sensor.setFrameBounds( 1000 + i, 11000, 20000 );
+        sensor.getMotionDelta( dx, dy );
+        sensor.read( adns9500::SHUTTER_UPPER, adns9500::SHUTTER_LOWER );
+    }
+
+    for( int rule = 0; rule < FakeAdns9500::RULES; rule++ ){
+        if( fake.closest[rule] != UINT64_MAX ){
+            test_note( "%-5s closest %llu ns, %u too short", FakeAdns9500::rule_names[rule],
+                fake.closest[rule], fake.violations[rule] );
+        }
+        CHECK_EQUAL( 0, fake.violations[rule] );
+    }
+}
+
+// The checker itself, a read right after a write breaks tSWR.
+TEST(transaction_timing_checker){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    SPI spi( p5, p6, SENSOR_SCLK );
+    DigitalOut ncs( SENSOR_NCS );
+    spi.frequency( adns9500::MAX_SPI_FREQUENCY );
+
+    ncs = 0;
+    spi.write( 0x80 | adns9500::CONFIGURATION_I );
+    spi.write( 0x12 );
+    spi.write( adns9500::CONFIGURATION_I );
+    wait_us( 100 );
+    CHECK_EQUAL( 0x12, spi.write( 0 ) );
+    // And a read without tSRAD.
+    wait_us( 20 );
+    spi.write( adns9500::PRODUCT_ID );
+    CHECK_EQUAL( 0x33, spi.write( 0 ) );
+    ncs = 1;
+
+    CHECK_EQUAL( 1, fake.violations[FakeAdns9500::TSWR] );
+    CHECK_EQUAL( 1, fake.violations[FakeAdns9500::TSRAD] );
+    CHECK_EQUAL( 0, fake.violations[FakeAdns9500::TSRR] );
+}
+
+#define FIRMWARE_LEN 3070
+
+static uint8_t firmware[FIRMWARE_LEN];
+
+static void make_firmware(){
+    for( int i = 0; i < FIRMWARE_LEN; i++ ){
+        firmware[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+}
+
+// Stand-ins for the rest of the boot: compiling the profiles, CPU work the
+// download is polled in between, and the host enumerating us, which is
+// just waiting.
+#define COMPILE_SLICES 50
+#define COMPILE_SLICE_US 100
+#define ENUMERATION_US 50000
+
+static void compile_profiles( adns9500::ADNS9500 *sensor ){
+    for( int i = 0; i < COMPILE_SLICES; i++ ){
+        wait_us( COMPILE_SLICE_US );
+        if( sensor ){
+            sensor->sromPoll();
+        }
+    }
+}
+
+/*
+ * The download used to block until the whole image was in and the CRC test
+ * done, only then did the boot go on. Now it is started first and polled
+ * through the rest of the boot, the same as main() does.
+ */
+TEST(srom_download_boot_time){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    make_firmware();
+
+    sensor.reset();
+    uint64_t start = sim_now_ns();
+    int crc = sensor.sromDownload( firmware, FIRMWARE_LEN );
+    uint64_t download_ns = sim_now_ns() - start;
+    compile_profiles( NULL );
+    wait_us( ENUMERATION_US );
+    uint64_t blocking_ns = sim_now_ns() - start;
+
+    CHECK_EQUAL( FIRMWARE_LEN, fake.srom_len );
+    CHECK( memcmp( fake.srom, firmware, FIRMWARE_LEN ) == 0 );
+
+    sensor.reset();
+    start = sim_now_ns();
+    sensor.sromStart( firmware, FIRMWARE_LEN );
+    compile_profiles( &sensor );
+    uint64_t enumerated = start + ENUMERATION_US * 1000ULL;
+    while( sensor.sromPoll() || sim_now_ns() < enumerated ){
+    }
+    uint64_t polled_ns = sim_now_ns() - start;
+
+    CHECK_EQUAL( FIRMWARE_LEN, fake.srom_len );
+    CHECK( memcmp( fake.srom, firmware, FIRMWARE_LEN ) == 0 );
+    CHECK_EQUAL( crc, sensor.sromCrc() );
+    CHECK_EQUAL( 0, fake.violations[FakeAdns9500::TLOAD] );
+
+    uint64_t compile_ns = COMPILE_SLICES * COMPILE_SLICE_US * 1000ULL;
+    uint64_t other_ns = compile_ns + ENUMERATION_US * 1000ULL;
+    test_note( "download %llu us, rest of the boot %llu us", download_ns / 1000, other_ns / 1000 );
+    test_note( "blocking %llu us, polled %llu us", blocking_ns / 1000, polled_ns / 1000 );
+    test_note( "closest tLOAD %llu ns", fake.closest[FakeAdns9500::TLOAD] );
+
+    // The enumeration is hidden completely, only the CPU work of the
+    // compile can hold up the download.
+    CHECK( polled_ns < download_ns + compile_ns );
+}
+
+struct Profile {
+    int res_x;
+    int res_y;
+    uint16_t fps_min;
+    uint16_t fps_max;
+    uint16_t shutter_max;
+};
+
+// What use_profile() does to the sensor.
+static void switch_profile( adns9500::ADNS9500 &sensor, const Profile &p ){
+    sensor.setResolutionRegisters( p.res_x, p.res_y );
+    sensor.setFrameBounds( p.fps_min, p.fps_max, p.shutter_max );
+}
+
+/*
+ * A profile switch is a read and three writes for the resolution and six
+ * writes for the frame bounds. With the shadow filled by resync() the read
+ * never goes out and a write only does if the value changes.
+ */
+TEST(shadow_profile_switch){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    sensor.reset();
+    sensor.resync();
+
+    // Same frame bounds, another resolution, and the other way around.
+    const Profile profiles[3] = {
+        { 0x12, 0x12, 2000, 11000, 20000 },
+        { 0x24, 0x24, 2000, 11000, 20000 },
+        { 0x24, 0x24, 1000, 11000, 20000 }
+    };
+    const uint32_t unshadowed = 1 + 3 + 6;
+    const int switches = 30;
+
+    switch_profile( sensor, profiles[0] );
+    uint32_t transactions = fake.reads + fake.writes;
+    uint32_t saved = sensor.shadowSaved();
+    uint64_t start = sim_now_ns();
+    for( int i = 1; i <= switches; i++ ){
+        switch_profile( sensor, profiles[i % 3] );
+    }
+    uint64_t bus_ns = sim_now_ns() - start;
+    transactions = fake.reads + fake.writes - transactions;
+    saved = sensor.shadowSaved() - saved;
+
+    test_note( "%d switches: %u transactions, %u saved by the shadow, %llu us each",
+        switches, transactions, saved, bus_ns / switches / 1000 );
+
+    CHECK_EQUAL( unshadowed * switches, transactions + saved );
+    // Only the registers that change go out, never a read.
+    CHECK( transactions * 2 < unshadowed * switches );
+    CHECK_EQUAL( 0x12, fake.regs[adns9500::CONFIGURATION_I] );
+    CHECK_EQUAL( 0x12, fake.regs[adns9500::CONFIGURATION_V] );
+    CHECK_EQUAL( 23500 & 0xff, fake.regs[adns9500::FRAME_PERIOD_MAX_BOUND_LOWER] );
+    CHECK_EQUAL( 23500 >> 8, fake.regs[adns9500::FRAME_PERIOD_MAX_BOUND_UPPER] );
+
+    // Switching to the current profile again costs nothing.
+    transactions = fake.reads + fake.writes;
+    switch_profile( sensor, profiles[0] );
+    CHECK_EQUAL( 0, fake.reads + fake.writes - transactions );
+}
+
+static uint16_t reg16( const FakeAdns9500 &fake, int upper, int lower ){
+    return fake.regs[upper] << 8 | fake.regs[lower];
+}
+
+/*
+ * The sensor takes the bounds when the max bound is written, so a profile
+ * that only moves the min or shutter bound still has to write it.
+ */
+TEST(frame_bounds_latch){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    sensor.reset();
+    sensor.resync();
+
+    CHECK( sensor.setFrameBounds( 2000, 11000, 15000 ) );
+    CHECK_EQUAL( 23500, fake.frame_period_max_bound );
+    CHECK_EQUAL( 47000000 / 11000, fake.frame_period_min_bound );
+    CHECK_EQUAL( 15000, fake.shutter_max_bound );
+
+    // Only the min bound changes.
+    CHECK( sensor.setFrameBounds( 2000, 8000, 15000 ) );
+    CHECK_EQUAL( 23500, fake.frame_period_max_bound );
+    CHECK_EQUAL( 47000000 / 8000, fake.frame_period_min_bound );
+    CHECK_EQUAL( 15000, fake.shutter_max_bound );
+
+    // Only the shutter bound changes.
+    CHECK( sensor.setFrameBounds( 2000, 8000, 10000 ) );
+    CHECK_EQUAL( 23500, fake.frame_period_max_bound );
+    CHECK_EQUAL( 47000000 / 8000, fake.frame_period_min_bound );
+    CHECK_EQUAL( 10000, fake.shutter_max_bound );
+
+    // Nothing changes, nothing is written.
+    uint32_t writes = fake.writes;
+    CHECK( sensor.setFrameBounds( 2000, 8000, 10000 ) );
+    CHECK_EQUAL( writes, fake.writes );
+    CHECK_EQUAL( 0, sim_errors );
+}
+
+TEST(frame_bounds_bad_range){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    sensor.reset();
+    sensor.resync();
+
+    CHECK( sensor.setFrameBounds( 2000, 11000, 20000 ) );
+
+    // A zero rate takes the limit of the sensor on that side.
+    CHECK( !sensor.setFrameBounds( 0, 11000, 20000 ) );
+    CHECK_EQUAL( 0xffff, reg16( fake, adns9500::FRAME_PERIOD_MAX_BOUND_UPPER,
+        adns9500::FRAME_PERIOD_MAX_BOUND_LOWER ) );
+    CHECK_EQUAL( 47000000 / 11000, reg16( fake, adns9500::FRAME_PERIOD_MIN_BOUND_UPPER,
+        adns9500::FRAME_PERIOD_MIN_BOUND_LOWER ) );
+
+    CHECK( !sensor.setFrameBounds( 2000, 0, 20000 ) );
+    CHECK_EQUAL( adns9500::MIN_FRAME_PERIOD, reg16( fake, adns9500::FRAME_PERIOD_MIN_BOUND_UPPER,
+        adns9500::FRAME_PERIOD_MIN_BOUND_LOWER ) );
+
+    // An empty range runs at the higher rate, with no room for the shutter.
+    CHECK( !sensor.setFrameBounds( 2000, 1000, 20000 ) );
+    CHECK_EQUAL( 47000, reg16( fake, adns9500::FRAME_PERIOD_MAX_BOUND_UPPER,
+        adns9500::FRAME_PERIOD_MAX_BOUND_LOWER ) );
+    CHECK_EQUAL( 47000, reg16( fake, adns9500::FRAME_PERIOD_MIN_BOUND_UPPER,
+        adns9500::FRAME_PERIOD_MIN_BOUND_LOWER ) );
+    CHECK_EQUAL( 0, reg16( fake, adns9500::SHUTTER_MAX_BOUND_UPPER,
+        adns9500::SHUTTER_MAX_BOUND_LOWER ) );
+
+    // Nothing halted.
+    CHECK_EQUAL( 0, sim_errors );
+}
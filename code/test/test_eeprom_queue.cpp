@@ -0,0 +1,172 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "fake_25lc.h"
+#include "eeprom_queue.h"
+
+#define EEPROM_SCLK p13
+#define EEPROM_CS   p15
+
+struct Bench {
+    Bench( uint32_t size = 0x10000 )
+        : fake( EEPROM_SCLK, EEPROM_CS ), spi( p11, p12, EEPROM_SCLK ),
+          eeprom( &spi, EEPROM_CS, size, 0x20 ), queue( &eeprom ) {
+        spi.format( 8, 3 );
+        spi.frequency( 4000000 );
+        for( int i = 0; i < 0x400; i++ ){
+            fake.mem[i] = (uint8_t)(i * 7);
+        }
+    }
+
+    // The tracking loop calling poll() once a ms until the queue is empty.
+    uint32_t drain( void ){
+        uint32_t ms = 0;
+        while( queue.pending() && ms < 1000 ){
+            uint64_t start = sim_now_ns();
+            queue.poll();
+            // poll() never waits for the write cycle.
+            CHECK( sim_now_ns() - start < 200000 );
+            wait_ms( 1 );
+            ms++;
+        }
+        wait_ms( 6 );
+        return ms;
+    }
+
+    Fake25LC fake;
+    SPI spi;
+    Ser25LCxxx eeprom;
+    EepromQueue queue;
+};
+
+/*
+ * Writes to one page, in any order, go out as a single page write. The
+ * gaps between them are read back and written unchanged.
+ */
+TEST(eeprom_queue_merge){
+    Bench b;
+    const uint8_t one[3] = { 0xa1, 0xa2, 0xa3 };
+    const uint8_t two[2] = { 0xb1, 0xb2 };
+    const uint8_t three[1] = { 0xc1 };
+    uint8_t before[0x20];
+    memcpy( before, &b.fake.mem[0x40], sizeof(before) );
+
+    CHECK( b.queue.write( 0x48, sizeof(one), one ) );
+    CHECK( b.queue.write( 0x44, sizeof(two), two ) );
+    CHECK( b.queue.write( 0x52, sizeof(three), three ) );
+    // Over again, the later write wins.
+    CHECK( b.queue.write( 0x49, 1, three ) );
+    CHECK_EQUAL( 0, b.fake.page_writes );
+
+    b.drain();
+    CHECK_EQUAL( 1, b.fake.page_writes );
+    CHECK_EQUAL( 1, b.queue.written );
+    CHECK_EQUAL( 0, b.fake.stalls );
+    CHECK_EQUAL( 0, b.fake.unlatched );
+
+    uint8_t want[0x20];
+    memcpy( want, before, sizeof(want) );
+    memcpy( &want[0x08], one, sizeof(one) );
+    memcpy( &want[0x04], two, sizeof(two) );
+    want[0x12] = three[0];
+    want[0x09] = three[0];
+    CHECK( memcmp( want, &b.fake.mem[0x40], sizeof(want) ) == 0 );
+}
+
+/*
+ * A write across pages is staged whole or not at all, a full queue takes
+ * nothing and leaves the staged pages as they were.
+ */
+TEST(eeprom_queue_full){
+    Bench b;
+    uint8_t data[0x40];
+    memset( data, 0x5a, sizeof(data) );
+
+    // Three pages, the last of them partly.
+    CHECK( b.queue.write( 0x100, 0x50, data ) );
+    // More of a staged page fits.
+    CHECK( b.queue.write( 0x150, 0x10, data ) );
+    // Staged page plus two new ones, one short.
+    CHECK( !b.queue.write( 0x150, 0x40, data ) );
+    // The last free page is still there.
+    CHECK( b.queue.write( 0x200, 0x20, data ) );
+    CHECK( !b.queue.write( 0x220, 1, data ) );
+
+    // Nothing of the refused writes went in.
+    uint8_t buf[0x20];
+    CHECK( b.queue.read( 0x160, sizeof(buf), buf ) );
+    CHECK( memcmp( buf, &b.fake.mem[0x160], sizeof(buf) ) == 0 );
+
+    b.drain();
+    CHECK_EQUAL( 4, b.fake.page_writes );
+    CHECK_EQUAL( 0, b.fake.stalls );
+    CHECK( !memcmp( &b.fake.mem[0x100], data, 0x40 ) );
+    CHECK( b.queue.write( 0x220, 1, data ) );
+}
+
+/*
+ * read() answers from the staged bytes before they are written, and waits
+ * out a write cycle instead of reading garbage.
+ */
+TEST(eeprom_queue_read_staged){
+    Bench b;
+    const uint8_t data[4] = { 1, 2, 3, 4 };
+    uint8_t buf[0x10];
+
+    CHECK( b.queue.write( 0x86, sizeof(data), data ) );
+    CHECK( b.queue.write( 0xa0, 1, data ) );
+    CHECK( b.queue.read( 0x80, sizeof(buf), buf ) );
+    for( int i = 0; i < 0x10; i++ ){
+        uint8_t want = i >= 6 && i < 10 ? data[i - 6] : b.fake.mem[0x80 + i];
+        CHECK_EQUAL( want, buf[i] );
+    }
+
+    // First page out, the second still staged, the part busy.
+    CHECK( b.queue.poll() );
+    CHECK( b.fake.busy() );
+    uint8_t byte;
+    CHECK( b.queue.read( 0xa0, 1, &byte ) );
+    CHECK_EQUAL( data[0], byte );
+    CHECK( b.queue.read( 0x88, 1, &byte ) );
+    CHECK_EQUAL( data[2], byte );
+    CHECK_EQUAL( 0, b.fake.stalls );
+}
+
+/*
+ * A page the EEPROM can not take stays staged rather than being dropped,
+ * and does not hold up the others.
+ */
+TEST(eeprom_queue_refused_page){
+    // The part is declared smaller than the address written.
+    Bench b( 0x1000 );
+    const uint8_t data[2] = { 0x11, 0x22 };
+
+    CHECK( b.queue.write( 0x1000, sizeof(data), data ) );
+    CHECK( !b.queue.poll() );
+    CHECK( b.queue.pending() );
+    CHECK_EQUAL( 0, b.fake.page_writes );
+
+    CHECK( b.queue.write( 0x20, sizeof(data), data ) );
+    b.queue.flush();
+    CHECK_EQUAL( 1, b.fake.page_writes );
+    CHECK_EQUAL( 0x11, b.fake.mem[0x20] );
+    // Still there.
+    CHECK( b.queue.pending() );
+    uint8_t buf[2];
+    CHECK( b.queue.read( 0x20, sizeof(buf), buf ) );
+    CHECK_EQUAL( 0x22, buf[1] );
+}
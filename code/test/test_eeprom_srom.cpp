@@ -0,0 +1,79 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "fake_adns9500.h"
+#include "fake_25lc.h"
+#include "eeprom_srom.h"
+
+// Pins and offsets of the tracking firmware.
+#define SENSOR_SCLK   p7
+#define SENSOR_NCS    p8
+#define SENSOR_MOTION p14
+#define EEPROM_SCLK   p13
+#define EEPROM_CS     p15
+#define FW_OFFSET     0xf000
+#define FW_LEN        3070
+
+/*
+ * The firmware streamed from the EEPROM in the tLOAD gaps has to reach the
+ * SROM byte for byte the same as from flash, without stretching tLOAD.
+ */
+TEST(eeprom_srom_matches_flash){
+    static uint8_t firmware[FW_LEN];
+    for( int i = 0; i < FW_LEN; i++ ){
+        firmware[i] = (uint8_t)(i * 13 + (i >> 7));
+    }
+
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    Fake25LC fake_eeprom( EEPROM_SCLK, EEPROM_CS );
+    memcpy( &fake_eeprom.mem[FW_OFFSET], firmware, FW_LEN );
+
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    SPI eeprom_spi( p11, p12, EEPROM_SCLK );
+    eeprom_spi.format( 8, 3 );
+    eeprom_spi.frequency( 8000000 );
+    Ser25LCxxx eeprom( &eeprom_spi, EEPROM_CS, 0x10000, 0x20 );
+
+    // Both runs start on a tick, the download waits on the us ticker.
+    sensor.reset();
+    sim_advance_ns( 1000 - sim_now_ns() % 1000 );
+    uint64_t start = sim_now_ns();
+    int flash_crc = sensor.sromDownload( firmware, FW_LEN );
+    uint64_t flash_ns = sim_now_ns() - start;
+    CHECK_EQUAL( FW_LEN, fake.srom_len );
+    CHECK( memcmp( fake.srom, firmware, FW_LEN ) == 0 );
+
+    sensor.reset();
+    memset( fake.srom, 0, sizeof(fake.srom) );
+    EepromSrom source( &eeprom, FW_OFFSET, FW_LEN );
+    uint32_t mallocs = sim_mallocs;
+    sim_advance_ns( 1000 - sim_now_ns() % 1000 );
+    start = sim_now_ns();
+    int eeprom_crc = sensor.sromDownload( &source );
+    uint64_t eeprom_ns = sim_now_ns() - start;
+    CHECK_EQUAL( 0, sim_mallocs - mallocs );
+    CHECK_EQUAL( FW_LEN, fake.srom_len );
+    CHECK( memcmp( fake.srom, firmware, FW_LEN ) == 0 );
+    CHECK_EQUAL( flash_crc, eeprom_crc );
+
+    CHECK_EQUAL( 0, fake.violations[FakeAdns9500::TLOAD] );
+    CHECK_EQUAL( 0, fake_eeprom.stalls );
+
+    test_note( "flash %llu us, EEPROM %llu us", flash_ns / 1000, eeprom_ns / 1000 );
+    // The EEPROM reads fit the tLOAD gaps, they cost no time over flash.
+    CHECK( eeprom_ns <= flash_ns );
+}
@@ -0,0 +1,76 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "event_queue.h"
+
+/*
+ * Far more events than slots, a few at a time, so the indexes go around
+ * many times. Everything comes out once and in order.
+ */
+TEST(event_queue_wrap){
+    EventQueue<uint32_t, 8> queue;
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+    uint32_t value = 0;
+
+    CHECK( queue.empty() );
+    CHECK( !queue.pop( value ) );
+    for( int round = 0; round < 1000; round++ ){
+        for( int i = 0; i < round % 9; i++ ){
+            if( queue.push( pushed ) ){
+                pushed++;
+            }
+        }
+        while( queue.pop( value ) ){
+            CHECK_EQUAL( popped, value );
+            popped++;
+        }
+        CHECK( queue.empty() );
+    }
+    CHECK_EQUAL( pushed, popped );
+    CHECK( pushed > 3000 );
+    // Seven fit, the rounds of eight lose one each.
+    CHECK_EQUAL( 111, queue.dropped );
+}
+
+/*
+ * A full queue keeps what it has and counts what it turned away, and
+ * takes events again once the loop catches up.
+ */
+TEST(event_queue_drop_count){
+    EventQueue<uint8_t, 4> queue;
+    uint8_t value = 0;
+
+    for( uint8_t i = 0; i < 3; i++ ){
+        CHECK( queue.push( i ) );
+    }
+    CHECK( !queue.push( 3 ) );
+    CHECK( !queue.push( 4 ) );
+    CHECK_EQUAL( 2, queue.dropped );
+
+    CHECK( queue.pop( value ) );
+    CHECK_EQUAL( 0, value );
+    CHECK( queue.push( 5 ) );
+    CHECK_EQUAL( 2, queue.dropped );
+
+    const uint8_t want[3] = { 1, 2, 5 };
+    for( int i = 0; i < 3; i++ ){
+        CHECK( queue.pop( value ) );
+        CHECK_EQUAL( want[i], value );
+    }
+    CHECK( queue.empty() );
+}
@@ -0,0 +1,85 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include <stdarg.h>
+#include "test.h"
+
+#undef printf
+
+static TestCase *tests;
+static TestCase *last;
+static int failures;
+
+TestCase::TestCase( const char *name, TestFunction function )
+    : name(name), function(function), next(NULL){
+    // In the order they are defined within a file.
+    if( last ){
+        last->next = this;
+    }
+    else{
+        tests = this;
+    }
+    last = this;
+}
+
+void test_check( bool ok, const char *what, const char *file, int line ){
+    if( !ok ){
+        printf("  %s:%d: CHECK(%s) failed\n", file, line, what);
+        failures++;
+    }
+}
+
+void test_check_equal( long long expected, long long actual, const char *what, const char *file, int line ){
+    if( expected != actual ){
+        printf("  %s:%d: %s is %lld, expected %lld\n", file, line, what, actual, expected);
+        failures++;
+    }
+}
+
+void test_note( const char *format, ... ){
+    va_list args;
+    va_start( args, format );
+    printf("  ");
+    vprintf( format, args );
+    printf("\n");
+    va_end( args );
+}
+
+int main( int argc, char **argv ){
+    int run = 0;
+    int failed = 0;
+
+    for( TestCase *t = tests; t != NULL; t = t->next ){
+        // A test name on the command line runs only the tests matching it.
+        if( argc > 1 && strstr( t->name, argv[1] ) == NULL ){
+            continue;
+        }
+        printf("%s\n", t->name);
+        sim_reset();
+        int before = failures;
+        t->function();
+        if( sim_errors ){
+            printf("  error(): %s", sim_error_text);
+            failures++;
+        }
+        if( failures != before ){
+            failed++;
+        }
+        run++;
+    }
+    printf("%d tests, %d failed\n", run, failed);
+    return failed ? 1 : 0;
+}
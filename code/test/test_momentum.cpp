@@ -0,0 +1,155 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "momentum.h"
+
+// Ball scrolling v steps every frame for a while, z button held.
+static void drag( MomentumScroll &momentum, int32_t v, int frames ){
+    int32_t out_v, out_h;
+    for( int i = 0; i < frames; i++ ){
+        momentum.scrolled( v, 0 );
+        momentum.frame( 1, true, out_v, out_h );
+        CHECK_EQUAL( 0, out_v );
+    }
+}
+
+// Frames until the glide stops, the steps it sent add up in total.
+static int glide( MomentumScroll &momentum, int32_t &total ){
+    int32_t v, h;
+    int32_t last = 1 << 20;
+    int frames = 0;
+
+    total = 0;
+    while( momentum.active() && frames < 10000 ){
+        momentum.frame( 1, false, v, h );
+        CHECK_EQUAL( 0, h );
+        // Never speeds up, give or take the carried fraction.
+        CHECK( abs( v ) <= last + 1 );
+        last = abs( v ) < last ? abs( v ) : last;
+        total += v;
+        frames++;
+    }
+    return frames;
+}
+
+/*
+ * A flick keeps scrolling after the button is let go, slowing down by the
+ * friction. At 4 steps a frame and 1/16 lost per frame that is about
+ * 4 * 16 steps, less the tail below MOMENTUM_STOP.
+ */
+TEST(momentum_flick){
+    MomentumScroll momentum;
+    momentum.setFriction( 0x1000 );
+    int32_t v, h, total;
+
+    drag( momentum, 4, 20 );
+    momentum.frame( 1, false, v, h );
+    CHECK( momentum.active() );
+    int frames = glide( momentum, total );
+
+    test_note( "glide of %d steps over %d frames", total, frames );
+    CHECK( !momentum.active() );
+    CHECK( total > 56 && total <= 64 );
+    CHECK( frames < 100 );
+
+    // Upwards exactly the same, mirrored.
+    drag( momentum, -4, 20 );
+    momentum.frame( 1, false, v, h );
+    int32_t total_up;
+    glide( momentum, total_up );
+    test_note( "and %d steps up", total_up );
+    CHECK( total_up < 0 );
+    CHECK_EQUAL( total, -total_up );
+}
+
+/*
+ * A slow drag is not a flick, even though every frame with a step in it
+ * looks fast on its own.
+ */
+TEST(momentum_slow_drag){
+    MomentumScroll momentum;
+    momentum.setFriction( 0x1000 );
+    int32_t v, h;
+
+    // One step every eight frames is 32/256 a frame, under MOMENTUM_START.
+    for( int i = 0; i < 8; i++ ){
+        drag( momentum, 1, 1 );
+        drag( momentum, 0, 7 );
+    }
+    drag( momentum, 1, 1 );
+    momentum.frame( 1, false, v, h );
+    CHECK( !momentum.active() );
+
+    // No friction, no momentum at all.
+    momentum.setFriction( 0 );
+    drag( momentum, 4, 20 );
+    momentum.frame( 1, false, v, h );
+    CHECK( !momentum.active() );
+}
+
+/*
+ * A ball that stops with the button still held glides on too, once it has
+ * been quiet for MOMENTUM_QUIET_FRAMES.
+ */
+TEST(momentum_ball_stopped){
+    MomentumScroll momentum;
+    momentum.setFriction( 0x1000 );
+    int32_t v, h, total;
+
+    drag( momentum, 4, 20 );
+    int quiet = 0;
+    while( quiet < 100 ){
+        momentum.frame( 1, true, v, h );
+        quiet++;
+        if( v ){
+            break;
+        }
+    }
+    test_note( "gliding after %d quiet frames", quiet );
+    CHECK_EQUAL( MOMENTUM_QUIET_FRAMES + 1, quiet );
+    glide( momentum, total );
+    CHECK( total > 40 );
+}
+
+/*
+ * Several frames handed over at once glide as far as one at a time, and
+ * ball motion or cancel() stops a glide.
+ */
+TEST(momentum_frames_and_cancel){
+    MomentumScroll one, many;
+    one.setFriction( 0x800 );
+    many.setFriction( 0x800 );
+    int32_t v, h, sum = 0;
+
+    drag( one, 6, 20 );
+    drag( many, 6, 20 );
+    one.frame( 1, false, v, h );
+    many.frame( 1, false, v, h );
+    for( int i = 0; i < 5; i++ ){
+        one.frame( 1, false, v, h );
+        sum += v;
+    }
+    many.frame( 5, false, v, h );
+    CHECK_EQUAL( sum, v );
+
+    many.scrolled( -1, 0 );
+    many.frame( 1, true, v, h );
+    CHECK_EQUAL( 0, v );
+
+    one.cancel();
+    CHECK( !one.active() );
+}
@@ -0,0 +1,235 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "motion_math.h"
+
+// The float version the fixed point replaced, in double so it is the exact
+// value to compare against.
+static double float_accel( int16_t d, uint32_t dt_us, uint16_t mult ){
+    double speed = fabs( (double)d ) * 1000000 / dt_us;
+    return d * (speed / (mult * 1000.0) + 1);
+}
+
+static double float_curve( int16_t d, uint32_t dt_us, const uint8_t *block ){
+    double speed = fabs( (double)d ) * 1000000 / dt_us;
+    double knot = speed / (1 << block[0]);
+    int knots = block[1];
+    int i = (int)knot;
+    double gain;
+
+    if( i >= knots - 1 ){
+        gain = block[2 + (knots - 1) * 2] | (block[3 + (knots - 1) * 2] << 8);
+    }
+    else{
+        double g0 = block[2 + i * 2] | (block[3 + i * 2] << 8);
+        double g1 = block[4 + i * 2] | (block[5 + i * 2] << 8);
+        gain = g0 + (g1 - g0) * (knot - i);
+    }
+    return d * gain / (1 << ACCEL_CURVE_GAIN_SHIFT);
+}
+
+// One report from a fresh instance, no fraction carried in.
+static int16_t one_report( MotionMath &math, int16_t d, uint32_t dt_us ){
+    int16_t dx = d;
+    int16_t dy = 0;
+    math.apply( dx, dy, dt_us );
+    return dx;
+}
+
+/*
+ * The speed is truncated to whole counts per second before it meets the
+ * reciprocal, which costs at most 1 / (mult * 1000) of gain per count. The
+ * Q16 gain and the rounded reciprocal are worth 2^-16 each. A report is
+ * then truncated, so it may be off by one count plus that.
+ */
+TEST(motion_reciprocal_vs_float){
+    const uint16_t mults[] = { 1, 2, 3, 7, 10, 33, 100, 1000, 65535 };
+    const uint32_t periods[] = { 85, 100, 250, 510 };
+    double worst = 0;
+    double worst_gain = 0;
+
+    for( unsigned m = 0; m < sizeof(mults) / sizeof(mults[0]); m++ ){
+        for( unsigned p = 0; p < sizeof(periods) / sizeof(periods[0]); p++ ){
+            for( int d = -300; d <= 300; d++ ){
+                MotionMath math;
+                math.setAcceleration( mults[m], mults[m] );
+                math.setPeriodBounds( 1, 1000000 );
+
+                double want = float_accel( d, periods[p], mults[m] );
+                if( fabs( want ) >= INT16_MAX ){
+                    continue;
+                }
+                double got = one_report( math, d, periods[p] );
+                double bound = 1 + abs( d ) * (1.0 / (mults[m] * 1000.0) + 2.0 / Q16_ONE);
+                double err = fabs( got - want );
+
+                if( err > bound ){
+                    CHECK( err <= bound );
+                    test_note( "mult %u, %u us, %d counts: %d for %.3f",
+                        mults[m], periods[p], d, (int)got, want );
+                }
+                if( err > worst ){
+                    worst = err;
+                }
+                if( d && (err - 1) / abs( d ) > worst_gain ){
+                    worst_gain = (err - 1) / abs( d );
+                }
+            }
+        }
+    }
+    test_note( "worst %.3f counts off a report, %.6f of gain past the truncation", worst, worst_gain );
+    CHECK( worst < 2 );
+}
+
+/*
+ * The knot lookup and interpolation against the same curve in floating
+ * point. Same truncated speed as above, times the steepest slope.
+ */
+TEST(motion_curve_vs_float){
+    uint8_t block[ACCEL_CURVE_BLOCK_LEN];
+    const int knots = 8;
+    const int shift = 12;
+    // Unity gain to 6x, steeper at the start.
+    const uint16_t gains[knots] = { 256, 384, 640, 896, 1024, 1152, 1280, 1536 };
+    const uint32_t periods[] = { 85, 100, 250, 510 };
+    double steepest = 256.0 / (1 << shift) / (1 << ACCEL_CURVE_GAIN_SHIFT);
+    double worst = 0;
+
+    block[0] = shift;
+    block[1] = knots;
+    for( int i = 0; i < knots; i++ ){
+        block[2 + i * 2] = gains[i] & 0xff;
+        block[3 + i * 2] = gains[i] >> 8;
+    }
+
+    for( unsigned p = 0; p < sizeof(periods) / sizeof(periods[0]); p++ ){
+        for( int d = -300; d <= 300; d++ ){
+            MotionMath math;
+            CHECK( math.setCurve( 0, block ) );
+            CHECK( math.setCurve( 1, block ) );
+            math.setPeriodBounds( 1, 1000000 );
+
+            double want = float_curve( d, periods[p], block );
+            double got = one_report( math, d, periods[p] );
+            double bound = 1 + abs( d ) * (steepest + 1.0 / Q16_ONE);
+            double err = fabs( got - want );
+
+            if( err > bound ){
+                CHECK( err <= bound );
+                test_note( "%u us, %d counts: %d for %.3f", periods[p], d, (int)got, want );
+            }
+            if( err > worst ){
+                worst = err;
+            }
+        }
+    }
+    test_note( "worst %.3f counts off a report", worst );
+
+    // Past the last knot the gain stays put.
+    MotionMath math;
+    math.setCurve( 0, block );
+    math.setCurve( 1, block );
+    CHECK_EQUAL( 100 * 1536 / 256, one_report( math, 100, 1 ) );
+
+    // An erased block turns the curves off.
+    memset( block, 0xff, sizeof(block) );
+    CHECK( !math.setCurve( 0, block ) );
+    CHECK_EQUAL( 5, one_report( math, 5, 100 ) );
+}
+
+/*
+ * A long slow trace through a scale that is not a whole number. The counts
+ * sent must stay within one of the exact scaled total all the way, where
+ * truncating every report on its own loses most of them.
+ */
+TEST(motion_residual_long_trace){
+    MotionMath math;
+    // 0.3 and a little rotation, exact in Q16 so the reference is too.
+    const q16_t xx = 19661, xy = -1311, yx = 1311, yy = 19661;
+    math.setMatrix( xx, xy, yx, yy );
+
+    int64_t in_x = 0, in_y = 0;
+    int64_t out_x = 0, out_y = 0;
+    int64_t truncated_x = 0;
+    double worst = 0;
+    uint32_t seed = 12345;
+
+    for( int i = 0; i < 200000; i++ ){
+        seed = seed * 1103515245 + 12345;
+        int16_t dx = (int16_t)((seed >> 16) % 7) - 2;
+        int16_t dy = (int16_t)((seed >> 20) % 5) - 2;
+        in_x += dx;
+        in_y += dy;
+        truncated_x += q16_to_int( (q16_t)(((int64_t)xx * q16_from_int( dx ) + (int64_t)xy * q16_from_int( dy )) >> Q16_SHIFT ) );
+
+        math.apply( dx, dy, 1000 );
+        out_x += dx;
+        out_y += dy;
+
+        double want_x = (double)(xx * in_x + xy * in_y) / Q16_ONE;
+        double want_y = (double)(yx * in_x + yy * in_y) / Q16_ONE;
+        double err = fabs( out_x - want_x ) > fabs( out_y - want_y ) ?
+            fabs( out_x - want_x ) : fabs( out_y - want_y );
+        if( err > worst ){
+            worst = err;
+        }
+    }
+    double want_x = (double)(xx * in_x + xy * in_y) / Q16_ONE;
+    test_note( "x %lld counts in, %lld sent for %.2f, %lld when truncated per report",
+        in_x, out_x, want_x, truncated_x );
+    test_note( "worst %.4f counts behind", worst );
+
+    CHECK( worst < 1 );
+    CHECK( fabs( truncated_x - want_x ) > 100 );
+}
+
+/*
+ * The same steady speed read on time, read late and read after a pause
+ * must all come out at the same gain. A read period clamped to a frame made
+ * the late read look five times faster.
+ */
+TEST(motion_read_period){
+    MotionMath math;
+    math.setPeriodBounds( 85, 490 );
+
+    // On time, an edge a frame after each read.
+    CHECK_EQUAL( 1000, math.readPeriod( 2000, 1000, 1400 ) );
+    // Late without a pause, the first edge came right after the last read.
+    CHECK_EQUAL( 5000, math.readPeriod( 6000, 1000, 1400 ) );
+    // Still moving after the last read, the pin never went up again.
+    CHECK_EQUAL( 3000, math.readPeriod( 4000, 1000, 900 ) );
+    // After a pause, a frame before the edge and no further back.
+    CHECK_EQUAL( 490 + 300, math.readPeriod( 10000300, 1000, 10000000 ) );
+    // Across the ticker wrap.
+    CHECK_EQUAL( 1000, math.readPeriod( 500, 0xfffffe0c, 0xffffff00 ) );
+
+    // 2000 counts per second with a multiplier of one, a gain of three.
+    math.setAcceleration( 1, 1 );
+    int16_t on_time = 2;
+    int16_t late = 10;
+    int16_t paused = 1;
+    int16_t dy = 0;
+    MotionMath late_math = math;
+    MotionMath paused_math = math;
+    math.apply( on_time, dy, math.readPeriod( 2000, 1000, 1400 ) );
+    late_math.apply( late, dy, late_math.readPeriod( 6000, 1000, 1400 ) );
+    paused_math.apply( paused, dy, paused_math.readPeriod( 10000000, 1000, 10000000 - 10 ) );
+    test_note( "on time %d, late %d, after a pause %d", on_time, late, paused );
+    CHECK_EQUAL( 6, on_time );
+    CHECK_EQUAL( 30, late );
+    CHECK_EQUAL( 3, paused );
+}
@@ -0,0 +1,136 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "fake_adns9500.h"
+#include "power.h"
+
+#define SENSOR_SCLK p7
+#define SENSOR_NCS p8
+#define SENSOR_MOTION p14
+
+static int rest_bits( const FakeAdns9500 &fake ){
+    return fake.regs[adns9500::CONFIGURATION_II] >> 6;
+}
+
+/*
+ * The part of the tracking loop that drives the power manager, run on the
+ * next ms boundary like the SOF wakes it. Returns the counts it read.
+ */
+static int tick( adns9500::ADNS9500 &sensor, PowerManager &power, Timer &idle_timer ){
+    int16_t dx = 0;
+    int16_t dy = 0;
+
+    wait_us( 1000 - sim_now_ns() / 1000 % 1000 );
+    if( sensor.motionPending() ){
+        power.motion();
+        idle_timer.reset();
+        sensor.getMotionDelta( dx, dy );
+    }
+    power.idle( idle_timer.read_ms() );
+    return dx + dy;
+}
+
+/*
+ * Still for longer than the deepest rest mode takes, then a nudge. Each
+ * step down has to come within a tick of its time, the sensor has to be
+ * told every time, and waking up must cost a single register write.
+ */
+TEST(power_idle_motion_timeline){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    sensor.reset();
+    PowerManager power( &sensor );
+    Timer idle_timer;
+    idle_timer.start();
+
+    const uint32_t rest_ms[3] = { POWER_REST1_MS, POWER_REST2_MS, POWER_REST3_MS };
+    uint32_t entered_ms[3] = { 0, 0, 0 };
+    PowerManager::states last = power.state;
+
+    fake.move( 5, 0 );
+    CHECK_EQUAL( 5, tick( sensor, power, idle_timer ) );
+    uint64_t still_ns = sim_now_ns();
+    for( uint32_t ms = 0; ms < POWER_REST3_MS + 5000; ms++ ){
+        tick( sensor, power, idle_timer );
+        if( power.state != last ){
+            // Only ever one step down at a time.
+            CHECK_EQUAL( last + 1, power.state );
+            CHECK_EQUAL( power.state, rest_bits( fake ) );
+            last = power.state;
+            entered_ms[last - 1] = (sim_now_ns() - still_ns + 500000) / 1000000;
+        }
+    }
+    CHECK_EQUAL( PowerManager::REST3, power.state );
+    for( int i = 0; i < 3; i++ ){
+        test_note( "rest %d after %u ms", i + 1, entered_ms[i] );
+        CHECK( entered_ms[i] >= rest_ms[i] );
+        CHECK( entered_ms[i] <= rest_ms[i] + 1 );
+    }
+
+    // Right after a tick, the worst case: the next tick wakes it up.
+    uint32_t writes = fake.writes;
+    uint64_t moved_ns = sim_now_ns();
+    fake.move( 0, 7 );
+    int ticks = 0;
+    int counts = 0;
+    while( ticks < 3 && rest_bits( fake ) != adns9500::REST_NONE ){
+        counts += tick( sensor, power, idle_timer );
+        ticks++;
+    }
+    uint32_t wake_us = (sim_now_ns() - moved_ns) / 1000;
+    test_note( "woken by tick %d, %u us after the motion with the read, %u writes",
+        ticks, wake_us, fake.writes - writes );
+
+    CHECK_EQUAL( PowerManager::RUN, power.state );
+    CHECK_EQUAL( 1, ticks );
+    CHECK_EQUAL( 1, fake.writes - writes );
+    CHECK( wake_us < 2000 );
+    // Nothing the sensor saw while resting is lost.
+    CHECK_EQUAL( 7, counts );
+    CHECK_EQUAL( 0, fake.violations[FakeAdns9500::TSWR] + fake.violations[FakeAdns9500::TSWW] );
+}
+
+/*
+ * A suspended host puts the sensor in the deepest rest mode, motion does
+ * not wake it until the bus resumes.
+ */
+TEST(power_suspend){
+    FakeAdns9500 fake( SENSOR_SCLK, SENSOR_NCS, SENSOR_MOTION );
+    adns9500::ADNS9500 sensor( p5, p6, SENSOR_SCLK, SENSOR_NCS, adns9500::MAX_SPI_FREQUENCY, SENSOR_MOTION );
+    sensor.reset();
+    PowerManager power( &sensor );
+    Timer idle_timer;
+    idle_timer.start();
+
+    power.suspend( true );
+    CHECK_EQUAL( PowerManager::REST3, power.state );
+    CHECK_EQUAL( adns9500::REST_3, rest_bits( fake ) );
+
+    fake.move( 1, 1 );
+    tick( sensor, power, idle_timer );
+    CHECK_EQUAL( PowerManager::REST3, power.state );
+
+    power.suspend( false );
+    CHECK_EQUAL( PowerManager::RUN, power.state );
+    CHECK_EQUAL( adns9500::REST_NONE, rest_bits( fake ) );
+
+    // Back to stepping down from the start.
+    for( uint32_t ms = 0; ms < POWER_REST1_MS + 2; ms++ ){
+        tick( sensor, power, idle_timer );
+    }
+    CHECK_EQUAL( PowerManager::REST1, power.state );
+}
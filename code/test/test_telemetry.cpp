@@ -0,0 +1,101 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "telemetry.h"
+#include "USBMouse.h"
+
+static uint16_t get16( const uint8_t *p ){
+    return p[0] | (p[1] << 8);
+}
+
+static adns9500::MotionBurstStats stats( uint16_t shutter, uint16_t frame_period ){
+    adns9500::MotionBurstStats s;
+    s.pixelSum = 0x30;
+    s.maximumPixel = 0x90;
+    s.minimumPixel = 0x08;
+    s.shutter = shutter;
+    s.framePeriod = frame_period;
+    return s;
+}
+
+/*
+ * The report has to match the layout in telemetry.h, and fill all of the
+ * REPORT_COUNT the descriptor declares, or the host gets a short report.
+ */
+TEST(telemetry_report_layout){
+    Telemetry telemetry( 16 );
+    uint8_t data[TELEMETRY_REPORT_LENGTH];
+    memset( data, 0xaa, sizeof(data) );
+    data[0] = REPORT_ID_TELEMETRY;
+
+    telemetry.sample( 10, stats( 100, 24000 ) );
+    telemetry.sample( 30, stats( 300, 24000 ) );
+    telemetry.sample( 50, stats( 5000, 12000 ) );
+
+    CHECK_EQUAL( TELEMETRY_REPORT_LENGTH, telemetry.report( data, TELEMETRY_REPORT_LENGTH ) );
+    CHECK_EQUAL( REPORT_ID_TELEMETRY, data[0] );
+    CHECK_EQUAL( TELEMETRY_VERSION, data[1] );
+    CHECK_EQUAL( 16, data[2] );
+    CHECK_EQUAL( 3, data[3] | (data[4] << 8) | (data[5] << 16) | (data[6] << 24) );
+
+    // min, max, mean of each channel from byte 7 on.
+    const uint8_t *squal = &data[7];
+    CHECK_EQUAL( 10, get16( squal ) );
+    CHECK_EQUAL( 50, get16( squal + 2 ) );
+    CHECK_EQUAL( 30, get16( squal + 4 ) );
+    const uint8_t *shutter = &data[7 + Telemetry::SHUTTER * 6];
+    CHECK_EQUAL( 100, get16( shutter ) );
+    CHECK_EQUAL( 5000, get16( shutter + 2 ) );
+    CHECK_EQUAL( 1800, get16( shutter + 4 ) );
+    const uint8_t *period = &data[7 + Telemetry::FRAME_PERIOD * 6];
+    CHECK_EQUAL( 12000, get16( period ) );
+    CHECK_EQUAL( 24000, get16( period + 2 ) );
+    CHECK_EQUAL( 20000, get16( period + 4 ) );
+
+    // Squal buckets of 22: 10, 30 and 50 land in 0, 1 and 2.
+    CHECK_EQUAL( 85, data[43] );
+    CHECK_EQUAL( 85, data[44] );
+    CHECK_EQUAL( 85, data[45] );
+    CHECK_EQUAL( 0, data[46] );
+    // Shutter buckets double from 256: 100 is 0, 300 is 1, 5000 is 5.
+    CHECK_EQUAL( 85, data[51] );
+    CHECK_EQUAL( 85, data[52] );
+    CHECK_EQUAL( 0, data[53] );
+    CHECK_EQUAL( 85, data[56] );
+
+    // Zero padded to the end.
+    for( int i = 59; i < TELEMETRY_REPORT_LENGTH; i++ ){
+        CHECK_EQUAL( 0, data[i] );
+    }
+}
+
+// A bucket about to overflow halves them all, the shares stay right.
+TEST(telemetry_bucket_overflow){
+    Telemetry telemetry( 16 );
+    uint8_t data[TELEMETRY_REPORT_LENGTH];
+
+    for( uint32_t i = 0; i < 0x18000; i++ ){
+        telemetry.sample( i % 4 ? 100 : 160, stats( 100, 24000 ) );
+    }
+    telemetry.report( data, TELEMETRY_REPORT_LENGTH );
+    // Three quarters in bucket 4 (88-109), a quarter in the last one.
+    CHECK( data[43 + 4] >= 190 && data[43 + 4] <= 192 );
+    CHECK( data[43 + 7] >= 62 && data[43 + 7] <= 64 );
+    CHECK_EQUAL( 255, data[51] );
+    // The mean fades old samples but stays in range.
+    CHECK_EQUAL( 115, get16( &data[7 + 4] ) );
+}
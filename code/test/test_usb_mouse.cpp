@@ -0,0 +1,213 @@
+/*
+ *  loststone is free sofware: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License 3 as published by
+ *  the Free Software Foundation.
+ *
+ *  loststone is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with loststone. If not, see <http://www.gnu.org/licenses/gpl.txt>.
+ *
+ *  Copyright (c) 2012-2013 Chris Majoros(chris@majoros.us), GNU3
+ */
+
+#include "test.h"
+#include "fake_usbhal.h"
+#include "USBMouse.h"
+#include "us_ticker_api.h"
+#include "event_queue.h"
+
+static int16_t get16( const uint8_t *p ){
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+struct Host {
+    Host() : reports(0), naks(0), x(0), y(0) {}
+
+    // One poll of the interrupt IN endpoint, the completion interrupt is
+    // left pending when service is false.
+    void poll( bool service ){
+        uint8_t data[64];
+        uint32_t length;
+
+        if( !fake_usb_poll( EPINT_IN, data, &length ) ){
+            naks++;
+            return;
+        }
+        CHECK_EQUAL( 8, length );
+        CHECK_EQUAL( REPORT_ID_MOUSE, data[0] );
+        reports++;
+        x += get16( &data[2] );
+        y += get16( &data[4] );
+        if( service ){
+            fake_usb_isr();
+        }
+    }
+
+    uint32_t reports;
+    uint32_t naks;
+    int64_t x;
+    int64_t y;
+};
+
+/*
+ * Motion every frame, in several moves and now and then more than a report
+ * holds three times over. The host gets one report per poll, reports per second equal the
+ * poll rate, and the counts add up.
+ */
+TEST(usb_mouse_report_per_poll){
+    USBMouse mouse( REL_MOUSE, 0x1234, 0x0001, 0x0001, false );
+    fake_usb_configure();
+    CHECK( mouse.configured() );
+
+    Host host;
+    int64_t moved_x = 0;
+    int64_t moved_y = 0;
+    uint32_t seed = 99;
+    const uint32_t frames = 1000;
+
+    for( uint32_t i = 0; i < frames; i++ ){
+        for( int j = 0; j < 3; j++ ){
+            seed = seed * 1103515245 + 12345;
+            int16_t dx = (int16_t)((seed >> 16) % 41) - 20;
+            int16_t dy = i % 100 == 50 ? 30000 : (int16_t)((seed >> 8) % 9) - 4;
+            mouse.move( dx, dy );
+            moved_x += dx;
+            moved_y += dy;
+        }
+        fake_usb_raise( FAKE_USB_SOF );
+        fake_usb_isr();
+        wait_us( 500 );
+        host.poll( true );
+        wait_us( 500 );
+    }
+    uint32_t naks = host.naks;
+    // Whatever did not fit goes out in the frames after.
+    for( int i = 0; i < 4; i++ ){
+        fake_usb_raise( FAKE_USB_SOF );
+        fake_usb_isr();
+        host.poll( true );
+    }
+
+    test_note( "%u frames, %u reports, %u NAKs", frames, host.reports, naks );
+    CHECK_EQUAL( moved_x, host.x );
+    CHECK_EQUAL( moved_y, host.y );
+    CHECK_EQUAL( 0, naks );
+    CHECK( host.reports >= frames );
+    CHECK_EQUAL( host.reports, mouse.reportCount() );
+}
+
+/*
+ * The host polls late in the frame, the completion is only serviced along
+ * with the next start of frame, which goes first and finds the endpoint
+ * still busy. The report has to go out from the completion, not wait a
+ * frame and halve the report rate.
+ */
+TEST(usb_mouse_sof_with_completion){
+    USBMouse mouse( REL_MOUSE, 0x1234, 0x0001, 0x0001, false );
+    fake_usb_configure();
+
+    Host host;
+    int64_t moved = 0;
+    const uint32_t frames = 1000;
+
+    mouse.move( 1, 0 );
+    moved++;
+    fake_usb_raise( FAKE_USB_SOF );
+    fake_usb_isr();
+    for( uint32_t i = 0; i < frames; i++ ){
+        mouse.move( 1, 0 );
+        moved++;
+        wait_us( 990 );
+        host.poll( false );
+        wait_us( 10 );
+        fake_usb_raise( FAKE_USB_SOF );
+        fake_usb_isr();
+    }
+    host.poll( true );
+
+    test_note( "%u frames, %u reports, %u NAKs", frames, host.reports, host.naks );
+    CHECK_EQUAL( 0, host.naks );
+    CHECK_EQUAL( frames + 1, host.reports );
+    CHECK_EQUAL( moved, host.x );
+}
+
+// The button event of main.h.
+struct InputEvent {
+    uint32_t time;
+    uint8_t type;
+    uint8_t button;
+};
+
+/*
+ * A button interrupt, timed with the ticker the way queue_button() times
+ * itself. It used to print the edge and report the button from the ISR, on
+ * the 9600 baud mbed console. It now only queues the edge.
+ */
+TEST(usb_mouse_button_isr_time){
+    USBMouse mouse( REL_MOUSE, 0x1234, 0x0001, 0x0001, false );
+    fake_usb_configure();
+    EventQueue<InputEvent, 16> events;
+    sim_console_baud = 9600;
+
+    uint32_t start = us_ticker_read();
+    printf( "button,left,press\n\r" );
+    mouse.press( MOUSE_LEFT );
+    uint32_t old_us = us_ticker_read() - start;
+
+    start = us_ticker_read();
+    InputEvent event;
+    event.time = start;
+    event.type = 0;
+    event.button = 0;
+    __disable_irq();
+    events.push( event );
+    __enable_irq();
+    uint32_t new_us = us_ticker_read() - start;
+
+    test_note( "button ISR: %u us printing and reporting, %u us queueing", old_us, new_us );
+    CHECK( new_us <= 1 );
+    CHECK( old_us > 10000 );
+    CHECK( !events.empty() );
+}
+
+static void frame_start( uint32_t sof_us ){
+}
+
+/*
+ * readToPollUs() runs from the sensor read of a report to the host taking
+ * it. A report flushed without a read since the last one, a button say,
+ * leaves it alone instead of timing from an older read.
+ */
+TEST(usb_mouse_read_to_poll){
+    USBMouse mouse( REL_MOUSE, 0x1234, 0x0001, 0x0001, false );
+    fake_usb_configure();
+    mouse.attachFrame( &frame_start );
+    Host host;
+
+    fake_usb_raise( FAKE_USB_SOF );
+    fake_usb_isr();
+    uint32_t read_us = us_ticker_read();
+    mouse.move( 5, 0 );
+    wait_us( 100 );
+    CHECK( mouse.flush( read_us, true ) );
+    wait_us( 300 );
+    host.poll( true );
+    uint32_t to_poll = mouse.readToPollUs();
+    CHECK( to_poll >= 400 && to_poll < 410 );
+
+    wait_us( 600 );
+    fake_usb_raise( FAKE_USB_SOF );
+    fake_usb_isr();
+    mouse.press( MOUSE_LEFT );
+    wait_us( 100 );
+    CHECK( mouse.flush( read_us, false ) );
+    wait_us( 300 );
+    host.poll( true );
+    CHECK_EQUAL( to_poll, mouse.readToPollUs() );
+    CHECK_EQUAL( 2, host.reports );
+    CHECK_EQUAL( 5, host.x );
+}
@@ -0,0 +1,117 @@
+import os
+import sys
+import hid
+import argparse
+import time
+
+HID_REPORT = 0x0
+REPORT_LEN = 0x41 # 64 bits plus the report number
+
+FRAME_GRAB = 0x07 # value *MUST* match the loststone code
+FRAME_GRAB_HEADER = 4
+FRAME_GRAB_PAYLOAD = 60
+FRAME_SIDE = 30
+FRAME_LEN = FRAME_SIDE * FRAME_SIDE
+PACKETS_PER_FRAME = FRAME_LEN // FRAME_GRAB_PAYLOAD
+
+parser = argparse.ArgumentParser(
+    description='Grab sensor frames from a loststone in programming mode.')
+
+parser.add_argument(
+    '--vid', metavar='VID', nargs='?',
+    required=False, default="0x1234",
+    help='USB vendor id of the loststone.')
+
+parser.add_argument(
+    '--pid', metavar='PID', nargs='?',
+    required=False, default="0x0006",
+    help='USB product id of the loststone.')
+
+parser.add_argument(
+    '--frames', metavar='N', nargs='?', type=int,
+    required=False, default=100,
+    help='Number of frames to save.')
+
+parser.add_argument(
+    '--out_dir', metavar='DIR', nargs='?',
+    required=False, default="frames",
+    help='Directory the PGM files are written to.')
+
+args = parser.parse_args()
+
+def write_pgm( path, pixels ):
+    with open(path, 'wb') as f:
+        f.write(("P5\n%d %d\n255\n" % (FRAME_SIDE, FRAME_SIDE)).encode('ascii'))
+        f.write(bytes(pixels))
+
+def send_action( h, action ):
+    rep = [0] * REPORT_LEN
+    rep[0] = HID_REPORT
+    rep[1] = action
+    h.write(rep)
+
+def grab( h ):
+    #
+    # Packets of a frame arrive in order. A missing or repeated index means
+    # a report was lost, the frame is dropped and we resync on the next one.
+    #
+    frame = bytearray(FRAME_LEN)
+    expect = 0
+    saved = 0
+    dropped = 0
+    fps = 0
+    start = time.time()
+
+    send_action(h, FRAME_GRAB)
+
+    while saved < args.frames:
+        rep = h.read(REPORT_LEN)
+        if not rep or rep[0] != FRAME_GRAB:
+            continue
+
+        seq = rep[1]
+        idx = rep[2]
+        fps = rep[3]
+
+        if idx != expect:
+            if expect != 0:
+                dropped = dropped + 1
+            expect = 0
+            if idx != 0:
+                continue
+
+        payload = rep[FRAME_GRAB_HEADER:FRAME_GRAB_HEADER + FRAME_GRAB_PAYLOAD]
+        frame[idx * FRAME_GRAB_PAYLOAD:(idx + 1) * FRAME_GRAB_PAYLOAD] = bytes(payload)
+        expect = expect + 1
+
+        if expect == PACKETS_PER_FRAME:
+            path = os.path.join(args.out_dir, "frame_%05d_%03d.pgm" % (saved, seq))
+            write_pgm(path, frame)
+            saved = saved + 1
+            expect = 0
+
+    # Any report stops the grab.
+    send_action(h, 0)
+
+    elapsed = time.time() - start
+    print("Saved %d frames in %.1fs (%.1f fps on the host, %d fps reported)" %
+        (saved, elapsed, saved / elapsed, fps))
+    if dropped:
+        print("Dropped %d incomplete frames" % dropped)
+
+
+if __name__ == '__main__':
+    if not os.path.isdir(args.out_dir):
+        os.makedirs(args.out_dir)
+
+    try:
+        h = hid.device(int(args.vid, 16), int(args.pid, 16))
+    except IOError as ex:
+        print("Error: %s" % ex)
+        sys.exit()
+
+    h.set_nonblocking(False)
+    print("Attached")
+    print("Product:      %s" % h.get_product_string())
+
+    grab(h)
@@ -6,14 +6,22 @@ import re
 from time import sleep
 import argparse
 import configparser
+import struct
 from collections import OrderedDict
 
 pp = pprint.PrettyPrinter(indent=4)
 
 HID_REPORT = 0x0
 SETTINGS_BASE = 0x00
-PROFILE_BASE = 0xff
-PROFILE_LEN = 0x14
+SETTINGS_VERSION = 1 # value *MUST* match the loststone code
+SETTINGS_HEADER_LEN = 8
+PROFILES = 5
+CURVE_BASE = 0xe000
+CURVE_MAX_KNOTS = 64
+CURVE_MAX_SHIFT = 15
+CURVE_BLOCK_LEN = 2 + CURVE_MAX_KNOTS * 2
+CURVE_GAIN_ONE = 0x100 # gains have 8 fraction bits
+LOAD_DATA_LEN = 59
 REPORT_LEN = 0x41 # 64 bits plus the report number
 
 BASE_DIR = os.path.dirname(os.path.realpath(__file__))
@@ -41,6 +49,10 @@ parser.add_argument(
     required=False, default=os.path.join(BASE_DIR, "adns9500_srom_91.txt"),
     help='ADNS firmware file.')
 
+parser.add_argument(
+    '--curves_only', action='store_true',
+    help='Only upload the acceleration curves.')
+
 args = parser.parse_args()
 
 cli_actions = { # values *MUST* match the loststone code
@@ -49,7 +61,8 @@ cli_actions = { # values *MUST* match the loststone code
     'LOAD_DATA':  0x0003,
     'GET_DATA':   0x0004,
     'CLEAR':      0x0005,
-    'INIT':       0x0006
+    'INIT':       0x0006,
+    'FRAME_GRAB': 0x0007
 }
 
 btns = { # values *MUST* match the loststone code
@@ -74,6 +87,11 @@ config = {
 settings = OrderedDict([
     ('CPI_X', 4320),
     ('CPI_Y', 4320),
+    ('CPI_X_MULITIPLYER', 0),
+    ('CPI_Y_MULITIPLYER', 0),
+    ('COORD_X_SKEW', 0),
+    ('COORD_Y_SKEW', 0),
+    ('SCROLL_SKIP', 4),
     ('CPI_MAX', 5040),
     ('CPI_MIN', 0),
     ('CPI_STEP', 90),
@@ -81,6 +99,10 @@ settings = OrderedDict([
     ('CPI_H', 0),
     ('CPI_HR_X', 360),
     ('CPI_HR_Y', 360),
+    ('FPS_MIN', 1958),
+    ('FPS_MAX', 11750),
+    ('SHUTTER_MAX', 20000),
+    ('MOMENTUM_FRICTION', 200),
     ('BTN_A', btns['LEFT']),
     ('BTN_B', btns['MIDDLE']),
     ('BTN_C', btns['RIGHT']),
@@ -98,9 +120,17 @@ settings = OrderedDict([
     ('ADNS_ID', 0x56),
     ('ADNS_FW_LEN', 0x0bfe),
     ('ADNS_FW_OFFSET', 0xF000),
+    ('READ_LEAD_US', 200),
 ])
 
+# The order above *MUST* match the settings enum of the loststone code, a
+# profile is everything up to LED_ACTION.
+PROFILE_LEN = list(settings.keys()).index('LED_ACTION') + 1
+
+PROFILE_NAMES = ['profile_a', 'profile_b', 'profile_c', 'profile_d', 'profile_e']
+
 profiles = dict()
+curves = dict()
 
 data = {
     'config': config,
@@ -161,117 +191,139 @@ def load_adns_firmware( h ):
 #
 
 
-def load_profiles( h ):
-    print( "Loading profiles" )
+def settings_crc( data ):
+    # CRC-16/CCITT, polynomial 0x1021 starting from 0xffff.
+    crc = 0xffff
+    for b in data:
+        crc = crc ^ (b << 8)
+        for bit in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xffff
+            else:
+                crc = (crc << 1) & 0xffff
+    return crc
 
+def settings_image():
     #
-    # initialize list 64 8bit values plus one for the report number
+    # The settings and then every profile, 16 bit little endian, behind a
+    # header with the layout and a CRC. The loststone reads it in one go and
+    # ignores all of it if anything does not match.
     #
-    rep = [0] * REPORT_LEN
-    p_num = 0
+    values = list(settings.values())
+    for name in PROFILE_NAMES:
+        values.extend(profiles[name].values())
 
-    #
-    # Doing one profile at a time to keep thinks simple.
-    for profile in profiles.values():
+    payload = b''.join(struct.pack('<H', v & 0xffff) for v in values)
+    header = struct.pack('<BBBBHH', SETTINGS_VERSION, len(settings),
+        PROFILE_LEN, PROFILES, len(payload), settings_crc(payload))
+    return list(header + payload)
 
-        print("Loading profile %s" % chr(0x41 + p_num))
-        p_base = PROFILE_BASE + (p_num * (PROFILE_LEN * 2)) & 0xff
-        rep[0] = HID_REPORT
-        rep[1] = cli_actions['LOAD_DATA']
-        rep[2] = p_base & 0xff
-        rep[3] = (p_base >> 8) & 0xff
-        rep[4] = len(profile) * 2 # 16 bit
+def load_settings( h ):
+    print( "Loading settings and profiles" )
 
-        i = 5
-        #
-        # Break up any values larger than 8bit's into two and pad ones lower.
-        # Nothing we have is larger than 16bit.
-        #
-
-        for a, v in profile.items():
-            if v < -128 or v > 127:
-                rep[i] = v & 0xff
-                i = i + 1
-                rep[i] = (v >> 8) & 0xff
-                i = i + 1
-            else:
-                rep[i] = v
-                i = i + 1
-                rep[i] = 0x0
-                i = i + 1
+    image = settings_image()
 
+    #
+    # The header goes last, an upload that stops half way leaves an image
+    # with a bad CRC rather than a valid looking mix of old and new.
+    #
+    chunks = list(range(SETTINGS_HEADER_LEN, len(image), LOAD_DATA_LEN))
+    chunks.append(0)
+    for i in chunks:
+        if i == 0:
+            chunk = image[:SETTINGS_HEADER_LEN]
+        else:
+            chunk = image[i:i + LOAD_DATA_LEN]
+        offset = SETTINGS_BASE + i
+        rep = [0] * REPORT_LEN
+        rep[0] = HID_REPORT
+        rep[1] = cli_actions['LOAD_DATA']
+        rep[2] = (offset >> 8) & 0xff
+        rep[3] = offset & 0xff
+        rep[4] = len(chunk)
+        rep[5:5 + len(chunk)] = chunk
         h.write(rep)
 
-        sleep(1)
-        #
-        # loststone reads the data it just wrote to the eeprom and sends it back.
-        # So we are putting it back together and comparing it to what we sent.
-        # even though we don't get it still need a bit for the report number.
-        #
-        print("Validating profile %s" % chr(0x41 + p_num))
+        # loststone sends back what it wrote.
         ret = h.read(REPORT_LEN)
-        i = 0
-        for a, v in profile.items():
-            test_val = ret[i+1]
-            test_val = (test_val << 8) | ret[i]
-            i = i + 2
-            if v != test_val:
-                print("ERROR: Attribute [%s] was not set correctly. Should be [%X] is [%X]." %
-                    (a, v, test_val))
+        if list(ret[:len(chunk)]) != chunk:
+            print("ERROR: Settings at [%X] were not written correctly." % offset)
 
-        p_num = p_num + 1
 
-def load_settings( h ):
-    print( "Loading settings" )
+def curve_block( shift, gains ):
+    block = [shift, len(gains)]
+    for g in gains:
+        v = int(round(g * CURVE_GAIN_ONE))
+        block.append(v & 0xff)
+        block.append((v >> 8) & 0xff)
+    return block
 
-    #
-    # initialize list 64 8bit values plus one for the report number
-    #
-    rep = [0] * REPORT_LEN
-    rep[0] = HID_REPORT
-    rep[1] = cli_actions['LOAD_DATA']
-    rep[2] = 0x0 # FIXME: change to global var
-    rep[3] = 0x0
-    rep[2] = SETTINGS_BASE & 0xff
-    rep[3] = (SETTINGS_BASE >> 8) & 0xff
-    rep[4] = len(settings) * 2 # 16 bit
-
-    #
-    # Break up any values larger than 8bit's into two and pad ones lower.
-    # Nothing we have is larger than 16bit.
-    #
-    i = 5
-    for a, v in settings.items():
-        if v < -128 or v > 127:
-            rep[i] = v & 0xff
-            i = i + 1
-            rep[i] = (v >>8) & 0xff
-            i = i + 1
-        else:
-            rep[i] = v
-            i = i + 1
-            rep[i] = 0x0
-            i = i + 1
+def load_curves( h ):
+    print( "Loading acceleration curves" )
 
-    h.write(rep)
-    sleep(1)
     #
-    # loststone reads the data it just wrote to the eeprom and sends it back.
-    # So we are putting it back together and comparing it to what we sent.
-    # even though we don't get it still need a bit for the report number.
+    # All profiles go in one pass. Profiles without curves get an erased
+    # header so the loststone falls back to the linear multiplier.
     #
-    print("Validating Settings")
-    ret = h.read(REPORT_LEN)
-    i = 0
-    for a, v in settings.items():
-        # Converting back to 16 bit so its easer to understand the values.
-        test_val = ret[i+1]
-        test_val = (test_val << 8) | ret[i]
-        i = i + 2
-        if v != test_val:
-            print("ERROR: Attribute [%s] was not set correctly. Shoulde be [%X] is [%X]." %
-                (a, v, test_val))
+    for p_num, name in enumerate(PROFILE_NAMES):
+        base = CURVE_BASE + p_num * CURVE_BLOCK_LEN * 2
+        for axis in range(2):
+            if name in curves:
+                block = curves[name][axis]
+            else:
+                block = [0xff, 0xff]
+
+            offset = base + axis * CURVE_BLOCK_LEN
+            for i in range(0, len(block), LOAD_DATA_LEN):
+                chunk = block[i:i + LOAD_DATA_LEN]
+                rep = [0] * REPORT_LEN
+                rep[0] = HID_REPORT
+                rep[1] = cli_actions['LOAD_DATA']
+                rep[2] = ((offset + i) >> 8) & 0xff
+                rep[3] = (offset + i) & 0xff
+                rep[4] = len(chunk)
+                rep[5:5 + len(chunk)] = chunk
+                h.write(rep)
+
+                # loststone sends back what it wrote.
+                ret = h.read(REPORT_LEN)
+                if list(ret[:len(chunk)]) != chunk:
+                    print("ERROR: Curve of profile %s was not written correctly." %
+                        chr(0x41 + p_num))
+
+def load_curve_config(p):
+    retval = True
+    for p_num, name in enumerate(PROFILE_NAMES):
+        section = 'curve_' + name[-1]
+        if not p.has_section(section):
+            continue
+
+        blocks = []
+        for axis in ['X', 'Y']:
+            try:
+                shift = int(p.get(section, 'SHIFT_' + axis))
+                gains = [float(g) for g in p.get(section, 'GAIN_' + axis).split(',')]
+            except (configparser.Error, ValueError) as err:
+                print("Section \"%s\" is not valid: %s" % (section, err))
+                retval = False
+                break
 
+            if shift < 0 or shift > CURVE_MAX_SHIFT:
+                print("SHIFT_%s in section \"%s\" must be 0 to %d." %
+                    (axis, section, CURVE_MAX_SHIFT))
+                retval = False
+            if len(gains) < 2 or len(gains) > CURVE_MAX_KNOTS:
+                print("GAIN_%s in section \"%s\" needs 2 to %d knots." %
+                    (axis, section, CURVE_MAX_KNOTS))
+                retval = False
+            if min(gains) < 0 or max(gains) * CURVE_GAIN_ONE > 0xffff:
+                print("GAIN_%s in section \"%s\" is out of range." % (axis, section))
+                retval = False
+            blocks.append(curve_block(shift, gains))
+
+        if len(blocks) == 2:
+            curves[name] = blocks
+    return retval
 
 # FIXME: this is pretty bad, need to redo this.
 def to_int(string):
@@ -327,7 +379,7 @@ def load_config(p):
                         (name, section))
                     retval = False
 
-    for profile in ['profile_a', 'profile_b', 'profile_c', 'profile_d', 'profile_e']:
+    for profile in PROFILE_NAMES:
 
         profiles[profile] = OrderedDict()
         i = 0 # TODO find a more pythonic way. islice does not allow assignment.
@@ -340,13 +392,15 @@ def load_config(p):
         if p.has_section(profile):
             for name in p.options(profile):
                 name = name.upper()
-                if name in settings:
-                    tmp = p.get(profile, name)
+                if name in profiles[profile]:
                     profiles[profile][name] = to_int(p.get(profile, name))
                 else:
                     print("The attribute \"%s\" in section \"%s\" is not valid." %
-                        (section, name))
+                        (name, profile))
                     retval = False
+    if not load_curve_config(p):
+        retval = False
+
     if not retval:
         print("Exiting, Nothing has bee programed.")
         sys.exit(2)
@@ -378,9 +432,13 @@ if __name__ == '__main__':
     print("Product:      %s" % h.get_product_string())
     print("Serial No:    %s" % h.get_serial_number_string())
 
+    if args.curves_only:
+        load_curves(h)
+        sys.exit()
+
     load_settings(h)
 
-    load_profiles(h)
+    load_curves(h)
 
     load_adns_firmware(h)
 
@@ -0,0 +1,64 @@
+import sys
+import hid
+import argparse
+import struct
+
+REPORT_ID_TELEMETRY = 0x03 # value *MUST* match the loststone code
+TELEMETRY_REPORT_LEN = 0x40 # 63 bytes plus the report number
+TELEMETRY_VERSION = 1
+BUCKETS = 8
+
+CHANNELS = [ 'SQUAL', 'PIXEL_SUM', 'MAX_PIXEL', 'MIN_PIXEL', 'SHUTTER', 'FRAME_PERIOD' ]
+
+parser = argparse.ArgumentParser(
+    description='Read the sensor telemetry of a loststone in tracking mode.')
+
+parser.add_argument(
+    '--vid', metavar='VID', nargs='?',
+    required=True,
+    help='USB vendor id of the loststone (the VID setting).')
+
+parser.add_argument(
+    '--pid', metavar='PID', nargs='?',
+    required=True,
+    help='USB product id of the loststone (the PID setting).')
+
+args = parser.parse_args()
+
+def histogram( name, buckets ):
+    print("%s histogram:" % name)
+    for i, b in enumerate(buckets):
+        print("  %d: %5.1f%% %s" % (i, b * 100.0 / 255, '#' * (b // 8)))
+
+if __name__ == '__main__':
+    #
+    # The telemetry is in its own vendor collection, which the OS exposes as
+    # a separate device next to the mouse.
+    #
+    path = None
+    for d in hid.enumerate(int(args.vid, 16), int(args.pid, 16)):
+        if d['usage_page'] == 0xff00:
+            path = d['path']
+    if path is None:
+        print("No loststone telemetry interface found.")
+        sys.exit(1)
+
+    h = hid.device()
+    h.open_path(path)
+
+    rep = h.get_feature_report(REPORT_ID_TELEMETRY, TELEMETRY_REPORT_LEN)
+    if len(rep) < 59 or rep[1] != TELEMETRY_VERSION:
+        print("Unexpected telemetry report: %s" % rep)
+        sys.exit(2)
+
+    interval = rep[2]
+    samples = struct.unpack_from('<I', bytes(rep), 3)[0]
+    print("%d samples, one every %d motion bursts" % (samples, interval))
+
+    print("%-14s %6s %6s %6s" % ('', 'min', 'max', 'mean'))
+    for i, name in enumerate(CHANNELS):
+        mn, mx, mean = struct.unpack_from('<HHH', bytes(rep), 7 + i * 6)
+        print("%-14s %6d %6d %6d" % (name, mn, mx, mean))
+
+    histogram('SQUAL', rep[43:43 + BUCKETS])
+    histogram('SHUTTER', rep[51:51 + BUCKETS])